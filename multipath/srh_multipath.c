@@ -0,0 +1,447 @@
+/* Weighted multipath spraying across several segment lists
+ *
+ * The lookup table follows Maglev (Eisenbud et al., NSDI 2016): every path
+ * walks its own permutation of the table slots, derived from a hash of its
+ * segments, and the paths take turns claiming the next free slot in their
+ * permutation until the table is full.  Because a path's permutation does not
+ * depend on the other paths, adding or removing one leaves most slots, and so
+ * most flows, where they were.  Weights are honoured by letting a path take a
+ * turn only once it has built up enough credit.
+ */
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+#include "srh_multipath.h"
+#include "sr_api.h"
+
+/* Flow label management, from linux/in6.h (which clashes with netinet/in.h) */
+#ifndef IPV6_FLOWLABEL_MGR
+#define IPV6_FLOWLABEL_MGR 32
+#endif
+#ifndef IPV6_FLOWINFO_SEND
+#define IPV6_FLOWINFO_SEND 33
+#endif
+#define IPV6_FL_A_GET    0
+#define IPV6_FL_F_CREATE 1
+#define IPV6_FL_S_USER   3
+
+struct flowlabel_req {
+    struct in6_addr flr_dst;
+    uint32_t flr_label;
+    uint8_t flr_action;
+    uint8_t flr_share;
+    uint16_t flr_flags;
+    uint16_t flr_expires;
+    uint16_t flr_linger;
+    uint32_t flr_pad;
+};
+
+#define FLOW_LABEL_MASK 0x000fffffu
+#define TABLE_EMPTY 0xffff
+
+
+static uint64_t mix64( uint64_t x ) {
+    // splitmix64 finalizer
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ull;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebull;
+    x ^= x >> 31;
+    return x;
+}
+
+static uint64_t hash_bytes( const void *buf, size_t len, uint64_t seed ) {
+    const uint8_t *bytes = buf;
+    uint64_t hash = mix64( seed ^ len );
+
+    while ( len >= 8 ) {
+        uint64_t word;
+        memcpy( &word, bytes, 8 );
+        hash = mix64( hash ^ word );
+        bytes += 8;
+        len -= 8;
+    }
+
+    uint64_t tail = 0;
+    memcpy( &tail, bytes, len );
+    return mix64( hash ^ tail );
+}
+
+static uint64_t path_key( const void *srh ) {
+    const struct ip6_rthdr4 *rthdr = srh;
+    return hash_bytes( rthdr->ip6r4_addr,
+            inet6_rth_segments_n( srh ) * sizeof (struct in6_addr), 0x5352 );
+}
+
+
+/*
+ * Table construction
+ */
+
+static int build_table( srh_multipath *mp ) {
+    const uint64_t size = SRH_MULTIPATH_TABLE_SIZE;
+    int n = mp->path_count;
+
+    uint64_t *offset = malloc( n * sizeof *offset );
+    uint64_t *skip = malloc( n * sizeof *skip );
+    uint64_t *next = calloc( n, sizeof *next );
+    uint64_t *credit = calloc( n, sizeof *credit );
+    mp->table = malloc( size * sizeof *mp->table );
+
+    if ( NULL == offset || NULL == skip || NULL == next || NULL == credit || NULL == mp->table ) {
+        free( offset );
+        free( skip );
+        free( next );
+        free( credit );
+        return 1;
+    }
+
+    uint32_t max_weight = 0;
+    for ( int i = 0; i < n; i++ ) {
+        offset[i] = mp->paths[i].key % size;
+        skip[i] = mix64( mp->paths[i].key ) % (size - 1) + 1;
+        if ( mp->paths[i].weight > max_weight )
+            max_weight = mp->paths[i].weight;
+    }
+
+    for ( uint64_t slot = 0; slot < size; slot++ )
+        mp->table[slot] = TABLE_EMPTY;
+
+    // The heaviest path claims a slot every round, lighter paths in
+    // proportion to their weight
+    uint64_t filled = 0;
+    while ( filled < size ) {
+        for ( int i = 0; i < n && filled < size; i++ ) {
+            credit[i] += mp->paths[i].weight;
+            if ( credit[i] < max_weight )
+                continue;
+            credit[i] -= max_weight;
+
+            uint64_t slot;
+            do {
+                slot = (offset[i] + next[i] * skip[i]) % size;
+                next[i]++;
+            } while ( mp->table[slot] != TABLE_EMPTY );
+
+            mp->table[slot] = i;
+            filled++;
+        }
+    }
+
+    free( offset );
+    free( skip );
+    free( next );
+    free( credit );
+    return 0;
+}
+
+srh_multipath *srh_multipath_create( void *const *srhs,
+        const uint32_t *weights,
+        int count ) {
+
+    if ( count < 1 || count > SRH_MULTIPATH_MAX_PATHS ) {
+        fprintf( stderr, "A path set needs between 1 and %d paths.\n", SRH_MULTIPATH_MAX_PATHS );
+        return NULL;
+    }
+
+    srh_multipath *mp = calloc( 1, sizeof *mp );
+    if ( NULL == mp )
+        return NULL;
+    mp->paths = calloc( count, sizeof *mp->paths );
+    if ( NULL == mp->paths )
+        goto fail;
+
+    for ( int i = 0; i < count; i++ ) {
+        int segments = inet6_rth_segments_n( srhs[i] );
+        if ( segments < 1 || weights[i] < 1 ) {
+            fprintf( stderr, "Path %d needs at least one segment and a weight of at least 1.\n", i );
+            goto fail;
+        }
+
+        srh_path *path = &mp->paths[mp->path_count];
+        path->srh_len = inet6_rth_space_n( IPV6_RTHDR_TYPE_4, segments );
+        path->srh = malloc( path->srh_len );
+        if ( NULL == path->srh )
+            goto fail;
+        memcpy( path->srh, srhs[i], path->srh_len );
+        path->weight = weights[i];
+        path->key = path_key( path->srh );
+        mp->path_count++;
+    }
+
+    if ( build_table( mp ) ) {
+        fprintf( stderr, "Out of memory building multipath table.\n" );
+        goto fail;
+    }
+
+    return mp;
+
+fail:
+    srh_multipath_free( mp );
+    return NULL;
+}
+
+/* Build a routing header from the SIDs on one line, last segment first */
+static void *parse_path( char *sids, int line_no ) {
+    struct in6_addr addrs[IPV6_RTHDR4_MAX_SEGMENTS];
+    int count = 0;
+    char *save = NULL;
+
+    for ( char *tok = strtok_r( sids, " \t\r\n", &save ); NULL != tok;
+            tok = strtok_r( NULL, " \t\r\n", &save ) ) {
+        if ( count == IPV6_RTHDR4_MAX_SEGMENTS ) {
+            fprintf( stderr, "Multipath line %d: more than %d segments\n", line_no,
+                    IPV6_RTHDR4_MAX_SEGMENTS );
+            return NULL;
+        }
+        if ( inet_pton( AF_INET6, tok, &addrs[count] ) != 1 ) {
+            fprintf( stderr, "Multipath line %d: error parsing address `%s`\n", line_no, tok );
+            return NULL;
+        }
+        count++;
+    }
+
+    if ( 0 == count ) {
+        fprintf( stderr, "Multipath line %d: expected `<weight> <sid> [<sid> ...]`\n", line_no );
+        return NULL;
+    }
+
+    socklen_t hdr_size = inet6_rth_space_n( IPV6_RTHDR_TYPE_4, count );
+    void *hdr = malloc( hdr_size );
+    if ( NULL == hdr || NULL == inet6_rth_init_n( hdr, hdr_size, IPV6_RTHDR_TYPE_4, count ) ) {
+        free( hdr );
+        return NULL;
+    }
+
+    for ( int i = 0; i < count; i++ ) {
+        if ( inet6_rth_add_n( hdr, &addrs[i] ) < 0 ) {
+            fprintf( stderr, "Multipath line %d: error adding segment %d\n", line_no, i );
+            free( hdr );
+            return NULL;
+        }
+    }
+
+    struct ip6_rthdr4 *rthdr = (struct ip6_rthdr4*)hdr;
+    rthdr->ip6r4_segleft = count - 1;
+    rthdr->ip6r4_lastentry = count - 1;
+
+    return hdr;
+}
+
+srh_multipath *srh_multipath_load( FILE *file ) {
+    void *srhs[SRH_MULTIPATH_MAX_PATHS];
+    uint32_t weights[SRH_MULTIPATH_MAX_PATHS];
+    srh_multipath *mp = NULL;
+    int count = 0, line_no = 0;
+    char *line = NULL;
+    size_t line_size = 0;
+
+    while ( getline( &line, &line_size, file ) != -1 ) {
+        line_no++;
+
+        // Ignore blank lines and lines starting with # for comment support
+        char *start = line;
+        while ( *start == ' ' || *start == '\t' )
+            start++;
+        if ( *start == '\0' || *start == '\n' || *start == '#' )
+            continue;
+
+        if ( count == SRH_MULTIPATH_MAX_PATHS ) {
+            fprintf( stderr, "Multipath line %d: too many paths\n", line_no );
+            goto done;
+        }
+
+        char *end;
+        unsigned long weight = strtoul( start, &end, 10 );
+        if ( end == start || weight < 1 || weight > UINT32_MAX ) {
+            fprintf( stderr, "Multipath line %d: weight must be a positive integer\n", line_no );
+            goto done;
+        }
+
+        srhs[count] = parse_path( end, line_no );
+        if ( NULL == srhs[count] )
+            goto done;
+        weights[count++] = weight;
+    }
+
+    mp = srh_multipath_create( srhs, weights, count );
+
+done:
+    for ( int i = 0; i < count; i++ )
+        free( srhs[i] );
+    free( line );
+    return mp;
+}
+
+void srh_multipath_free( srh_multipath *mp ) {
+    if ( NULL == mp )
+        return;
+
+    if ( NULL != mp->paths )
+        for ( int i = 0; i < mp->path_count; i++ )
+            free( mp->paths[i].srh );
+    free( mp->paths );
+    free( mp->table );
+    free( mp );
+}
+
+
+/*
+ * Flow hashing and path selection
+ */
+
+uint64_t srh_multipath_flow_hash( const struct sockaddr_in6 *local,
+        const struct sockaddr_in6 *remote,
+        int proto ) {
+    uint8_t key[16 + 16 + 2 + 2 + 1];
+
+    memcpy( key, &local->sin6_addr, 16 );
+    memcpy( key + 16, &remote->sin6_addr, 16 );
+    memcpy( key + 32, &local->sin6_port, 2 );
+    memcpy( key + 34, &remote->sin6_port, 2 );
+    key[36] = proto;
+
+    return hash_bytes( key, sizeof key, 0 );
+}
+
+const srh_path *srh_multipath_select( const srh_multipath *mp, uint64_t hash ) {
+    // Multiply-shift maps the hash onto the table without a division
+    uint64_t slot = ((hash >> 32) * SRH_MULTIPATH_TABLE_SIZE) >> 32;
+    return &mp->paths[mp->table[slot]];
+}
+
+uint32_t srh_multipath_flow_label( uint64_t hash ) {
+    uint32_t label = (hash ^ (hash >> 20) ^ (hash >> 40)) & FLOW_LABEL_MASK;
+    return label ? label : 1;
+}
+
+
+/*
+ * Socket helpers
+ */
+
+int srh_multipath_attach( const srh_multipath *mp, int fd ) {
+    struct sockaddr_in6 local, remote;
+    socklen_t local_len = sizeof local, remote_len = sizeof remote;
+    int proto = 0;
+    socklen_t proto_len = sizeof proto;
+
+    if ( getsockname( fd, (struct sockaddr*)&local, &local_len ) < 0 ||
+            getpeername( fd, (struct sockaddr*)&remote, &remote_len ) < 0 ||
+            getsockopt( fd, SOL_SOCKET, SO_PROTOCOL, &proto, &proto_len ) < 0 )
+        return -1;
+
+    const srh_path *path = srh_multipath_select( mp,
+            srh_multipath_flow_hash( &local, &remote, proto ) );
+
+    if ( setsockopt( fd, IPPROTO_IPV6, IPV6_RTHDR, path->srh, path->srh_len ) < 0 )
+        return -1;
+
+    // The socket is already connected, so its label can only come from the
+    // kernel, which hashes the socket's random txhash rather than our flow.
+    // That is the default; asking for it only matters on hosts where
+    // net.ipv6.auto_flowlabels makes it opt-in, and failing is harmless.
+    int on = 1;
+    setsockopt( fd, IPPROTO_IPV6, IPV6_AUTOFLOWLABEL, &on, sizeof on );
+
+    return path - mp->paths;
+}
+
+int srh_multipath_connect( const srh_multipath *mp,
+        int fd,
+        const struct sockaddr_in6 *dst,
+        uint64_t flow_hash ) {
+
+    const srh_path *path = srh_multipath_select( mp, flow_hash );
+    struct sockaddr_in6 addr = *dst;
+    int on = 1;
+
+    if ( setsockopt( fd, IPPROTO_IPV6, IPV6_RTHDR, path->srh, path->srh_len ) < 0 )
+        return -1;
+
+    // Labels have to be leased from the kernel before they can be sent with.
+    // Sharing them per user lets every worker process lease the same label.
+    struct flowlabel_req req;
+    memset( &req, 0, sizeof req );
+    req.flr_dst = dst->sin6_addr;
+    req.flr_label = htonl( srh_multipath_flow_label( flow_hash ) );
+    req.flr_action = IPV6_FL_A_GET;
+    req.flr_share = IPV6_FL_S_USER;
+    req.flr_flags = IPV6_FL_F_CREATE;
+
+    if ( setsockopt( fd, IPPROTO_IPV6, IPV6_FLOWLABEL_MGR, &req, sizeof req ) == 0 &&
+            setsockopt( fd, IPPROTO_IPV6, IPV6_FLOWINFO_SEND, &on, sizeof on ) == 0 ) {
+        addr.sin6_flowinfo = req.flr_label;
+    } else {
+        addr.sin6_flowinfo = 0;
+        setsockopt( fd, IPPROTO_IPV6, IPV6_AUTOFLOWLABEL, &on, sizeof on );
+    }
+
+    return connect( fd, (struct sockaddr*)&addr, sizeof addr );
+}
+
+srh_multipath_udp *srh_multipath_udp_open( const srh_multipath *mp,
+        const struct sockaddr_in6 *dst ) {
+
+    srh_multipath_udp *udp = calloc( 1, sizeof *udp );
+    if ( NULL == udp )
+        return NULL;
+
+    udp->mp = mp;
+    udp->fds = malloc( mp->path_count * sizeof *udp->fds );
+    if ( NULL == udp->fds ) {
+        free( udp );
+        return NULL;
+    }
+
+    // The kernel only takes Type-4 headers as a socket option, not as
+    // ancillary data, so each path needs a socket of its own
+    for ( ; udp->fd_count < mp->path_count; udp->fd_count++ ) {
+        const srh_path *path = &mp->paths[udp->fd_count];
+        int fd = socket( AF_INET6, SOCK_DGRAM, 0 );
+
+        if ( fd < 0 )
+            goto fail;
+        udp->fds[udp->fd_count] = fd;
+
+        if ( setsockopt( fd, IPPROTO_IPV6, IPV6_RTHDR, path->srh, path->srh_len ) < 0 ||
+                connect( fd, (const struct sockaddr*)dst, sizeof *dst ) < 0 ) {
+            udp->fd_count++;
+            goto fail;
+        }
+    }
+
+    return udp;
+
+fail:
+    srh_multipath_udp_close( udp );
+    return NULL;
+}
+
+void srh_multipath_udp_close( srh_multipath_udp *udp ) {
+    if ( NULL == udp )
+        return;
+
+    for ( int i = 0; i < udp->fd_count; i++ )
+        close( udp->fds[i] );
+    free( udp->fds );
+    free( udp );
+}
+
+ssize_t srh_multipath_udp_send( const srh_multipath_udp *udp,
+        const void *buf,
+        size_t len,
+        int flags,
+        uint64_t flow_hash ) {
+
+    const srh_path *path = srh_multipath_select( udp->mp, flow_hash );
+    return send( udp->fds[path - udp->mp->paths], buf, len, flags );
+}
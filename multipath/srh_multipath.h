@@ -0,0 +1,172 @@
+/* Weighted multipath spraying across several segment lists
+ *
+ * A set of segment lists, each with a weight, is turned into a Maglev-style
+ * lookup table.  Every flow is hashed once and the hash indexes the table, so
+ * picking a path is O(1), and rebuilding the table after adding or removing a
+ * path only moves flows that have to move.  Sockets are also given an IPv6
+ * flow label, derived from the flow where the socket is connected here and
+ * chosen by the kernel otherwise, so that routers downstream get entropy for
+ * their own ECMP hashing.
+ *
+ * Multipath file format (one path per line, # starts a comment):
+ *
+ *   <weight> <sid> [<sid> ...]
+ *
+ * SIDs are listed in the same order as segments.txt, last segment first, and
+ * the last segment MUST be the destination address.
+ */
+#ifndef __SRH_MULTIPATH_H__
+#define __SRH_MULTIPATH_H__
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+/* Number of slots in the lookup table.  It must be prime, and much larger
+ * than the number of paths for the weights to be followed closely. */
+#define SRH_MULTIPATH_TABLE_SIZE 65537
+
+/* Maximum number of paths in one set */
+#define SRH_MULTIPATH_MAX_PATHS 1024
+
+/* One weighted segment list */
+struct srh_path {
+    void *srh;
+    socklen_t srh_len;
+    uint32_t weight;
+    uint64_t key;  /* Hash of the segments, which identifies the path */
+};
+typedef struct srh_path srh_path;
+
+/* A weighted path set and its lookup table */
+struct srh_multipath {
+    int path_count;
+    srh_path *paths;
+    uint16_t *table;
+};
+typedef struct srh_multipath srh_multipath;
+
+/* Datagram sockets to one destination, one per path of a set, each connected
+ * with its path's routing header */
+struct srh_multipath_udp {
+    const srh_multipath *mp;
+    int fd_count;
+    int *fds;
+};
+typedef struct srh_multipath_udp srh_multipath_udp;
+
+/* Load a weighted set of segment lists
+ * Args:
+ * file - File pointer for the multipath file
+ *
+ * Return: The path set with its lookup table built, or NULL on failure
+ */
+srh_multipath *srh_multipath_load( FILE *file );
+
+/* Build a path set from routing headers already in memory.  The headers are
+ * copied, so the caller keeps ownership of its own.
+ * Args:
+ * srhs    - Array of count Type-4 routing headers
+ * weights - Array of count weights, each at least one
+ * count   - The number of paths
+ *
+ * Return: The path set with its lookup table built, or NULL on failure
+ */
+srh_multipath *srh_multipath_create( void *const *srhs,
+        const uint32_t *weights,
+        int count );
+
+/* Release a path set
+ * Args:
+ * mp - The path set to free, or a null pointer
+ */
+void srh_multipath_free( srh_multipath *mp );
+
+/* Hash a flow.  The same flow always hashes the same way, in every process.
+ * Args:
+ * local  - The local address and port
+ * remote - The remote address and port
+ * proto  - The transport protocol (e.g. IPPROTO_TCP)
+ *
+ * Return: The flow hash
+ */
+uint64_t srh_multipath_flow_hash( const struct sockaddr_in6 *local,
+        const struct sockaddr_in6 *remote,
+        int proto );
+
+/* Pick the path for a flow in O(1)
+ * Args:
+ * mp   - The path set
+ * hash - The flow hash
+ *
+ * Return: The chosen path
+ */
+const srh_path *srh_multipath_select( const srh_multipath *mp, uint64_t hash );
+
+/* Derive a non-zero 20 bit flow label from a flow hash
+ * Args:
+ * hash - The flow hash
+ *
+ * Return: The flow label, in host byte order
+ */
+uint32_t srh_multipath_flow_label( uint64_t hash );
+
+/* Steer a connected socket (e.g. one returned by accept) onto its flow's
+ * path, and let the kernel set a per-flow label on its packets.
+ * Args:
+ * mp - The path set
+ * fd - The connected socket
+ *
+ * Return: The index of the chosen path, or -1 on failure
+ */
+int srh_multipath_attach( const srh_multipath *mp, int fd );
+
+/* Connect a socket over the path chosen by flow_hash, sending with the flow
+ * label derived from the same hash.  If the kernel refuses the label, the
+ * kernel's own per-flow label is used instead.
+ * Args:
+ * mp        - The path set
+ * fd        - An unconnected socket
+ * dst       - The address and port to connect to
+ * flow_hash - The flow hash, e.g. from srh_multipath_flow_hash
+ *
+ * Return: The result of connect(), or -1 if the path could not be set
+ */
+int srh_multipath_connect( const srh_multipath *mp,
+        int fd,
+        const struct sockaddr_in6 *dst,
+        uint64_t flow_hash );
+
+/* Open a datagram socket per path to one destination.  Routing headers can
+ * only be set per socket, so datagrams take different paths by going out of
+ * different sockets.  Each socket carries its own kernel chosen flow label.
+ * Args:
+ * mp  - The path set, which must outlive the sockets
+ * dst - The destination address and port
+ *
+ * Return: The sockets, or NULL on failure
+ */
+srh_multipath_udp *srh_multipath_udp_open( const srh_multipath *mp,
+        const struct sockaddr_in6 *dst );
+
+/* Close the sockets of a path set
+ * Args:
+ * udp - The sockets to close, or a null pointer
+ */
+void srh_multipath_udp_close( srh_multipath_udp *udp );
+
+/* Send one datagram over the path chosen by flow_hash
+ * Args:
+ * udp       - The sockets from srh_multipath_udp_open
+ * buf, len  - The payload
+ * flags     - Flags for send
+ * flow_hash - The flow hash, e.g. from srh_multipath_flow_hash
+ *
+ * Return: The result of send()
+ */
+ssize_t srh_multipath_udp_send( const srh_multipath_udp *udp,
+        const void *buf,
+        size_t len,
+        int flags,
+        uint64_t flow_hash );
+#endif
@@ -0,0 +1,1029 @@
+/* Constrained shortest path computation for SRv6 segment lists
+ *
+ * See path_compute.h for the topology file format and the public API.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include <arpa/inet.h>
+
+#include "path_compute.h"
+#include "sr_api.h"
+
+/* Distances are saturated just below this value, which marks "unreachable" */
+#define SR_PATH_INFINITY UINT32_MAX
+
+/* Most labels one latency bounded search may create before giving up */
+#define MAX_LABELS (1 << 20)
+
+#define TOPO_LINE_SIZE 512
+#define TOPO_NAME_SIZE 64
+
+
+/* A partial path in the latency bounded search: its totals, the node it ends
+ * at, and the label (and link) it extends */
+struct path_label {
+    uint32_t metric;
+    uint32_t latency;
+    int node;
+    int parent;
+    int link;
+};
+
+/* Per-thread working memory for shortest path runs.  Each worker owns one of
+ * these so the threads never share anything but the read-only topology.
+ */
+struct spf_scratch {
+    uint64_t *key;
+    uint32_t *metric_sum;
+    uint32_t *latency_sum;
+    int *pred_node;
+    int *pred_link;
+
+    /* Binary min-heap with lazy deletion: stale entries are skipped on pop,
+     * so a shortest path run never holds more than one entry per link plus
+     * the source.  Only the latency bounded search can make it grow. */
+    uint64_t *heap_key;
+    int *heap_node;
+    int heap_size;
+    int heap_cap;
+
+    /* Latency bounded search state, grown on demand */
+    struct path_label *labels;
+    int label_count;
+    int label_cap;
+    uint32_t *best_latency;
+    int *first_label;
+
+    int *hops;
+    struct in6_addr *segments;
+};
+typedef struct spf_scratch spf_scratch;
+
+
+static uint32_t sat_add( uint32_t a, uint32_t b ) {
+    uint32_t sum = a + b;
+    if ( sum < a || sum >= SR_PATH_INFINITY )
+        return SR_PATH_INFINITY - 1;
+    return sum;
+}
+
+static uint32_t name_hash( const char *name ) {
+    // FNV-1a
+    uint32_t hash = 2166136261u;
+    while ( *name ) {
+        hash ^= (uint8_t)*name++;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static int resolve_threads( int nthreads, int work_items ) {
+    if ( nthreads <= 0 ) {
+        long online = sysconf( _SC_NPROCESSORS_ONLN );
+        nthreads = online > 0 ? (int)online : 1;
+    }
+    if ( nthreads > work_items )
+        nthreads = work_items;
+    if ( nthreads < 1 )
+        nthreads = 1;
+    return nthreads;
+}
+
+
+/*
+ * Topology loading
+ */
+
+static int name_slots_rebuild( sr_topology *topo, int slot_count ) {
+    int *slots = malloc( slot_count * sizeof *slots );
+    if ( NULL == slots )
+        return 1;
+    memset( slots, 0xff, slot_count * sizeof *slots );
+
+    for ( int n = 0; n < topo->node_count; n++ ) {
+        uint32_t slot = name_hash( topo->names[n] ) & (slot_count - 1);
+        while ( slots[slot] != -1 )
+            slot = (slot + 1) & (slot_count - 1);
+        slots[slot] = n;
+    }
+
+    free( topo->name_slots );
+    topo->name_slots = slots;
+    topo->name_slot_count = slot_count;
+    return 0;
+}
+
+int sr_topology_find( const sr_topology *topo, const char *name ) {
+    if ( 0 == topo->name_slot_count )
+        return -1;
+
+    uint32_t mask = topo->name_slot_count - 1;
+    uint32_t slot = name_hash( name ) & mask;
+    while ( topo->name_slots[slot] != -1 ) {
+        if ( strcmp( topo->names[topo->name_slots[slot]], name ) == 0 )
+            return topo->name_slots[slot];
+        slot = (slot + 1) & mask;
+    }
+    return -1;
+}
+
+static int add_node( sr_topology *topo, int *capacity, const char *name,
+        const struct in6_addr *sid ) {
+    if ( topo->node_count == *capacity ) {
+        int new_capacity = *capacity ? *capacity * 2 : 64;
+        char **names = realloc( topo->names, new_capacity * sizeof *names );
+        if ( NULL == names )
+            return 1;
+        topo->names = names;
+        struct in6_addr *sids = realloc( topo->sids, new_capacity * sizeof *sids );
+        if ( NULL == sids )
+            return 1;
+        topo->sids = sids;
+        *capacity = new_capacity;
+    }
+
+    topo->names[topo->node_count] = strdup( name );
+    if ( NULL == topo->names[topo->node_count] )
+        return 1;
+    topo->sids[topo->node_count] = *sid;
+    topo->node_count++;
+
+    // Keep the hash at most half full
+    if ( topo->node_count * 2 > topo->name_slot_count )
+        return name_slots_rebuild( topo, topo->name_slot_count ? topo->name_slot_count * 2 : 128 );
+
+    uint32_t mask = topo->name_slot_count - 1;
+    uint32_t slot = name_hash( name ) & mask;
+    while ( topo->name_slots[slot] != -1 )
+        slot = (slot + 1) & mask;
+    topo->name_slots[slot] = topo->node_count - 1;
+    return 0;
+}
+
+/* Links as they appear in the file, before being sorted into CSR order */
+struct raw_link {
+    int from;
+    int to;
+    uint32_t metric;
+    uint32_t latency;
+    uint32_t affinity;
+    int has_adj_sid;
+    struct in6_addr adj_sid;
+};
+
+static int build_csr( sr_topology *topo, const struct raw_link *links, int count ) {
+    int n = topo->node_count;
+
+    topo->link_count = count;
+    topo->row = calloc( n + 1, sizeof *topo->row );
+    topo->col = malloc( (count ? count : 1) * sizeof *topo->col );
+    topo->metric = malloc( (count ? count : 1) * sizeof *topo->metric );
+    topo->latency = malloc( (count ? count : 1) * sizeof *topo->latency );
+    topo->affinity = malloc( (count ? count : 1) * sizeof *topo->affinity );
+    topo->adj_sids = malloc( (count ? count : 1) * sizeof *topo->adj_sids );
+    topo->has_adj_sid = malloc( count ? count : 1 );
+    uint32_t *cursor = malloc( (n + 1) * sizeof *cursor );
+
+    if ( NULL == topo->row || NULL == topo->col || NULL == topo->metric ||
+            NULL == topo->latency || NULL == topo->affinity ||
+            NULL == topo->adj_sids || NULL == topo->has_adj_sid || NULL == cursor ) {
+        free( cursor );
+        return 1;
+    }
+
+    // Count the out degree of every node, then turn that into row offsets
+    for ( int l = 0; l < count; l++ )
+        topo->row[links[l].from + 1]++;
+    for ( int v = 0; v < n; v++ )
+        topo->row[v + 1] += topo->row[v];
+
+    memcpy( cursor, topo->row, (n + 1) * sizeof *cursor );
+    for ( int l = 0; l < count; l++ ) {
+        uint32_t at = cursor[links[l].from]++;
+        topo->col[at] = links[l].to;
+        topo->metric[at] = links[l].metric;
+        topo->latency[at] = links[l].latency;
+        topo->affinity[at] = links[l].affinity;
+        topo->adj_sids[at] = links[l].adj_sid;
+        topo->has_adj_sid[at] = links[l].has_adj_sid;
+    }
+
+    free( cursor );
+    return 0;
+}
+
+sr_topology *sr_topology_load( FILE *file ) {
+    sr_topology *topo = calloc( 1, sizeof *topo );
+    struct raw_link *links = NULL;
+    int link_count = 0, link_capacity = 0, node_capacity = 0;
+    int line_no = 0;
+    char line[TOPO_LINE_SIZE];
+
+    if ( NULL == topo )
+        return NULL;
+
+    while ( fgets( line, sizeof line, file ) != NULL ) {
+        char keyword[16], a[TOPO_NAME_SIZE], b[TOPO_NAME_SIZE];
+        char affinity[TOPO_NAME_SIZE], adj[TOPO_NAME_SIZE];
+        unsigned int metric, latency;
+
+        line_no++;
+
+        // Ignore blank lines and lines starting with # for comment support
+        char *start = line;
+        while ( isspace( (unsigned char)*start ) )
+            start++;
+        if ( *start == '\0' || *start == '#' )
+            continue;
+
+        if ( sscanf( start, "%15s", keyword ) != 1 )
+            continue;
+
+        if ( strcmp( keyword, "node" ) == 0 ) {
+            struct in6_addr sid;
+            if ( sscanf( start, "node %63s %63s", a, b ) != 2 ||
+                    inet_pton( AF_INET6, b, &sid ) != 1 ) {
+                fprintf( stderr, "Topology line %d: expected `node <name> <sid>`\n", line_no );
+                goto fail;
+            }
+            if ( sr_topology_find( topo, a ) != -1 ) {
+                fprintf( stderr, "Topology line %d: duplicate node `%s`\n", line_no, a );
+                goto fail;
+            }
+            if ( add_node( topo, &node_capacity, a, &sid ) ) {
+                fprintf( stderr, "Out of memory loading topology.\n" );
+                goto fail;
+            }
+
+        } else if ( strcmp( keyword, "link" ) == 0 ) {
+            int fields = sscanf( start, "link %63s %63s %u %u %63s %63s",
+                    a, b, &metric, &latency, affinity, adj );
+            if ( fields < 5 ) {
+                fprintf( stderr, "Topology line %d: expected `link <from> <to> <metric> <latency> <affinity> [adjacency sid]`\n", line_no );
+                goto fail;
+            }
+
+            if ( link_count == link_capacity ) {
+                link_capacity = link_capacity ? link_capacity * 2 : 256;
+                struct raw_link *grown = realloc( links, link_capacity * sizeof *links );
+                if ( NULL == grown ) {
+                    fprintf( stderr, "Out of memory loading topology.\n" );
+                    goto fail;
+                }
+                links = grown;
+            }
+
+            struct raw_link *link = &links[link_count];
+            memset( link, 0, sizeof *link );
+            link->from = sr_topology_find( topo, a );
+            link->to = sr_topology_find( topo, b );
+            if ( link->from < 0 || link->to < 0 ) {
+                fprintf( stderr, "Topology line %d: link uses undeclared node `%s`\n",
+                        line_no, link->from < 0 ? a : b );
+                goto fail;
+            }
+            if ( metric < 1 ) {
+                fprintf( stderr, "Topology line %d: link metric must be at least 1\n", line_no );
+                goto fail;
+            }
+            link->metric = metric;
+            link->latency = latency;
+            link->affinity = strtoul( affinity, NULL, 0 );
+
+            if ( fields == 6 ) {
+                if ( inet_pton( AF_INET6, adj, &link->adj_sid ) != 1 ) {
+                    fprintf( stderr, "Topology line %d: error parsing adjacency SID `%s`\n", line_no, adj );
+                    goto fail;
+                }
+                link->has_adj_sid = 1;
+            }
+            link_count++;
+
+        } else {
+            fprintf( stderr, "Topology line %d: unknown entry `%s`\n", line_no, keyword );
+            goto fail;
+        }
+    }
+
+    if ( build_csr( topo, links, link_count ) ) {
+        fprintf( stderr, "Out of memory loading topology.\n" );
+        goto fail;
+    }
+
+    free( links );
+    return topo;
+
+fail:
+    free( links );
+    sr_topology_free( topo );
+    return NULL;
+}
+
+void sr_topology_free( sr_topology *topo ) {
+    if ( NULL == topo )
+        return;
+
+    for ( int n = 0; n < topo->node_count; n++ )
+        free( topo->names[n] );
+    free( topo->names );
+    free( topo->sids );
+    free( topo->name_slots );
+    free( topo->row );
+    free( topo->col );
+    free( topo->metric );
+    free( topo->latency );
+    free( topo->affinity );
+    free( topo->adj_sids );
+    free( topo->has_adj_sid );
+    free( topo->igp_dist );
+    free( topo->igp_ecmp );
+    free( topo );
+}
+
+
+/*
+ * Shortest path runs
+ */
+
+static spf_scratch *scratch_alloc( const sr_topology *topo ) {
+    int n = topo->node_count;
+    int heap_cap = topo->link_count + 1;
+    spf_scratch *s = calloc( 1, sizeof *s );
+    if ( NULL == s )
+        return NULL;
+
+    s->key = malloc( n * sizeof *s->key );
+    s->metric_sum = malloc( n * sizeof *s->metric_sum );
+    s->latency_sum = malloc( n * sizeof *s->latency_sum );
+    s->pred_node = malloc( n * sizeof *s->pred_node );
+    s->pred_link = malloc( n * sizeof *s->pred_link );
+    s->heap_key = malloc( heap_cap * sizeof *s->heap_key );
+    s->heap_node = malloc( heap_cap * sizeof *s->heap_node );
+    s->heap_cap = heap_cap;
+    s->best_latency = malloc( n * sizeof *s->best_latency );
+    s->first_label = malloc( n * sizeof *s->first_label );
+    s->hops = malloc( (n + 1) * sizeof *s->hops );
+    s->segments = malloc( SR_PATH_MAX_SEGMENTS * sizeof *s->segments );
+    return s;
+}
+
+static void scratch_free( spf_scratch *s ) {
+    if ( NULL == s )
+        return;
+    free( s->key );
+    free( s->metric_sum );
+    free( s->latency_sum );
+    free( s->pred_node );
+    free( s->pred_link );
+    free( s->heap_key );
+    free( s->heap_node );
+    free( s->labels );
+    free( s->best_latency );
+    free( s->first_label );
+    free( s->hops );
+    free( s->segments );
+    free( s );
+}
+
+static int scratch_ok( const spf_scratch *s ) {
+    return NULL != s && NULL != s->key && NULL != s->metric_sum &&
+        NULL != s->latency_sum && NULL != s->pred_node &&
+        NULL != s->pred_link && NULL != s->heap_key &&
+        NULL != s->heap_node && NULL != s->best_latency &&
+        NULL != s->first_label && NULL != s->hops && NULL != s->segments;
+}
+
+static int heap_push( spf_scratch *s, uint64_t key, int node ) {
+    if ( s->heap_size == s->heap_cap ) {
+        int cap = s->heap_cap * 2;
+        uint64_t *keys = realloc( s->heap_key, cap * sizeof *keys );
+        if ( NULL == keys )
+            return 1;
+        s->heap_key = keys;
+        int *nodes = realloc( s->heap_node, cap * sizeof *nodes );
+        if ( NULL == nodes )
+            return 1;
+        s->heap_node = nodes;
+        s->heap_cap = cap;
+    }
+
+    int i = s->heap_size++;
+    while ( i > 0 ) {
+        int parent = (i - 1) / 2;
+        if ( s->heap_key[parent] <= key )
+            break;
+        s->heap_key[i] = s->heap_key[parent];
+        s->heap_node[i] = s->heap_node[parent];
+        i = parent;
+    }
+    s->heap_key[i] = key;
+    s->heap_node[i] = node;
+    return 0;
+}
+
+static int heap_pop( spf_scratch *s, uint64_t *key ) {
+    int top = s->heap_node[0];
+    *key = s->heap_key[0];
+
+    uint64_t last_key = s->heap_key[--s->heap_size];
+    int last_node = s->heap_node[s->heap_size];
+    int i = 0;
+    while ( 1 ) {
+        int child = 2 * i + 1;
+        if ( child >= s->heap_size )
+            break;
+        if ( child + 1 < s->heap_size && s->heap_key[child + 1] < s->heap_key[child] )
+            child++;
+        if ( last_key <= s->heap_key[child] )
+            break;
+        s->heap_key[i] = s->heap_key[child];
+        s->heap_node[i] = s->heap_node[child];
+        i = child;
+    }
+    s->heap_key[i] = last_key;
+    s->heap_node[i] = last_node;
+    return top;
+}
+
+static int link_allowed( const sr_topology *topo, uint32_t l,
+        uint32_t include_any, uint32_t exclude_any ) {
+    uint32_t aff = topo->affinity[l];
+    if ( include_any && !(aff & include_any) )
+        return 0;
+    return !(aff & exclude_any);
+}
+
+/* Shortest path tree from src over the links allowed by the affinity masks.
+ * The key being minimized is (metric, latency) packed into 64 bits, so ties
+ * on metric break on latency.
+ */
+static void spf_constrained( const sr_topology *topo, spf_scratch *s, int src,
+        uint32_t include_any, uint32_t exclude_any ) {
+    for ( int n = 0; n < topo->node_count; n++ ) {
+        s->key[n] = UINT64_MAX;
+        s->pred_node[n] = -1;
+        s->pred_link[n] = -1;
+    }
+
+    s->key[src] = 0;
+    s->metric_sum[src] = 0;
+    s->latency_sum[src] = 0;
+    s->heap_size = 0;
+    heap_push( s, 0, src );
+
+    while ( s->heap_size > 0 ) {
+        uint64_t key;
+        int u = heap_pop( s, &key );
+        if ( key != s->key[u] )
+            continue;
+
+        for ( uint32_t l = topo->row[u]; l < topo->row[u + 1]; l++ ) {
+            if ( !link_allowed( topo, l, include_any, exclude_any ) )
+                continue;
+
+            int v = topo->col[l];
+            uint32_t metric = sat_add( s->metric_sum[u], topo->metric[l] );
+            uint32_t latency = sat_add( s->latency_sum[u], topo->latency[l] );
+            uint64_t next = ((uint64_t)metric << 32) | latency;
+
+            if ( next < s->key[v] ) {
+                s->key[v] = next;
+                s->metric_sum[v] = metric;
+                s->latency_sum[v] = latency;
+                s->pred_node[v] = u;
+                s->pred_link[v] = l;
+                heap_push( s, next, v );
+            }
+        }
+    }
+}
+
+static int label_add( spf_scratch *s, uint32_t metric, uint32_t latency,
+        int node, int parent, int link ) {
+    if ( s->label_count == s->label_cap ) {
+        if ( s->label_cap == MAX_LABELS )
+            return 1;
+        int cap = s->label_cap ? s->label_cap * 2 : 1024;
+        struct path_label *labels = realloc( s->labels, cap * sizeof *labels );
+        if ( NULL == labels )
+            return 1;
+        s->labels = labels;
+        s->label_cap = cap;
+    }
+
+    struct path_label *label = &s->labels[s->label_count];
+    label->metric = metric;
+    label->latency = latency;
+    label->node = node;
+    label->parent = parent;
+    label->link = link;
+
+    return heap_push( s, ((uint64_t)metric << 32) | latency, s->label_count++ );
+}
+
+/* Latency bounded shortest paths from src: for every node, the path with the
+ * lowest metric (then latency) among those whose latency is at most
+ * max_latency.  This is a label-setting search over (metric, latency) pairs.
+ * Labels are settled in (metric, latency) order, and a label is only kept if
+ * its latency beats every label already settled at its node, since any other
+ * label is dominated.  The first label settled at a node is therefore its
+ * cheapest path within the bound, and is recorded in first_label.
+ *
+ * Return: Zero if the search finished, nonzero if it ran out of labels, in
+ * which case only nodes with a first_label are solved
+ */
+static int spf_latency_bounded( const sr_topology *topo, spf_scratch *s, int src,
+        uint32_t max_latency, uint32_t include_any, uint32_t exclude_any ) {
+    for ( int n = 0; n < topo->node_count; n++ ) {
+        s->best_latency[n] = SR_PATH_INFINITY;
+        s->first_label[n] = -1;
+    }
+
+    s->label_count = 0;
+    s->heap_size = 0;
+    if ( label_add( s, 0, 0, src, -1, -1 ) )
+        return 1;
+
+    while ( s->heap_size > 0 ) {
+        uint64_t key;
+        int index = heap_pop( s, &key );
+        struct path_label label = s->labels[index];
+
+        if ( label.latency >= s->best_latency[label.node] )
+            continue;
+        s->best_latency[label.node] = label.latency;
+        if ( -1 == s->first_label[label.node] )
+            s->first_label[label.node] = index;
+
+        int u = label.node;
+        for ( uint32_t l = topo->row[u]; l < topo->row[u + 1]; l++ ) {
+            if ( !link_allowed( topo, l, include_any, exclude_any ) )
+                continue;
+
+            int v = topo->col[l];
+            uint32_t latency = sat_add( label.latency, topo->latency[l] );
+            if ( latency > max_latency || latency >= s->best_latency[v] )
+                continue;
+
+            if ( label_add( s, sat_add( label.metric, topo->metric[l] ), latency, v, index, l ) )
+                return 1;
+        }
+    }
+
+    return 0;
+}
+
+/* Copy the path of a label into the per-node arrays that minimize_segments
+ * walks.  Settled paths never revisit a node, so this cannot form a loop. */
+static void label_to_path( spf_scratch *s, int index ) {
+    for ( ; index != -1; index = s->labels[index].parent ) {
+        const struct path_label *label = &s->labels[index];
+        s->metric_sum[label->node] = label->metric;
+        s->latency_sum[label->node] = label->latency;
+        s->pred_link[label->node] = label->link;
+        s->pred_node[label->node] = label->parent == -1 ? -1 : s->labels[label->parent].node;
+    }
+}
+
+/* Unconstrained metric-only shortest paths from src, counting (up to two) how
+ * many equal cost paths reach each node.  This is what plain IPv6 forwarding
+ * does with a segment, so it decides where explicit segments are needed.
+ */
+static void spf_igp( sr_topology *topo, spf_scratch *s, int src ) {
+    int n = topo->node_count;
+    uint32_t *dist = topo->igp_dist + (size_t)src * n;
+    uint8_t *count = topo->igp_ecmp + (size_t)src * n;
+
+    for ( int v = 0; v < n; v++ ) {
+        dist[v] = SR_PATH_INFINITY;
+        count[v] = 0;
+    }
+
+    dist[src] = 0;
+    count[src] = 1;
+    s->heap_size = 0;
+    heap_push( s, 0, src );
+
+    while ( s->heap_size > 0 ) {
+        uint64_t key;
+        int u = heap_pop( s, &key );
+        if ( key != dist[u] )
+            continue;
+
+        // Metrics are at least one, so every path into u has been counted by
+        // the time u is popped
+        for ( uint32_t l = topo->row[u]; l < topo->row[u + 1]; l++ ) {
+            int v = topo->col[l];
+            uint32_t d = sat_add( dist[u], topo->metric[l] );
+            if ( d < dist[v] ) {
+                dist[v] = d;
+                count[v] = count[u];
+                heap_push( s, d, v );
+            } else if ( d == dist[v] ) {
+                count[v] = count[v] + count[u] > 2 ? 2 : count[v] + count[u];
+            }
+        }
+    }
+
+    // Only keep whether the path is unique
+    for ( int v = 0; v < n; v++ )
+        count[v] = count[v] > 1;
+}
+
+struct prepare_job {
+    sr_topology *topo;
+    int next;
+    int failed;
+};
+
+static void *prepare_worker( void *arg ) {
+    struct prepare_job *job = arg;
+    spf_scratch *s = scratch_alloc( job->topo );
+
+    if ( !scratch_ok( s ) ) {
+        __atomic_store_n( &job->failed, 1, __ATOMIC_RELAXED );
+        scratch_free( s );
+        return NULL;
+    }
+
+    int src;
+    while ( (src = __atomic_fetch_add( &job->next, 1, __ATOMIC_RELAXED )) < job->topo->node_count )
+        spf_igp( job->topo, s, src );
+
+    scratch_free( s );
+    return NULL;
+}
+
+/* Run worker over nthreads threads (the calling thread being one of them) */
+static int run_parallel( void *(*worker)( void * ), void *job, int nthreads ) {
+    pthread_t *threads = malloc( nthreads * sizeof *threads );
+    int started = 0;
+
+    if ( NULL == threads )
+        return 1;
+
+    for ( int t = 1; t < nthreads; t++ ) {
+        if ( pthread_create( &threads[started], NULL, worker, job ) != 0 )
+            break;
+        started++;
+    }
+
+    worker( job );
+
+    for ( int t = 0; t < started; t++ )
+        pthread_join( threads[t], NULL );
+
+    free( threads );
+    return 0;
+}
+
+int sr_topology_prepare( sr_topology *topo, int nthreads ) {
+    size_t n = topo->node_count;
+
+    free( topo->igp_dist );
+    free( topo->igp_ecmp );
+    topo->igp_dist = malloc( (n ? n * n : 1) * sizeof *topo->igp_dist );
+    topo->igp_ecmp = malloc( n ? n * n : 1 );
+    if ( NULL == topo->igp_dist || NULL == topo->igp_ecmp ) {
+        fprintf( stderr, "Out of memory preparing topology.\n" );
+        free( topo->igp_dist );
+        free( topo->igp_ecmp );
+        topo->igp_dist = NULL;
+        topo->igp_ecmp = NULL;
+        return 1;
+    }
+
+    struct prepare_job job = { topo, 0, 0 };
+    if ( run_parallel( prepare_worker, &job, resolve_threads( nthreads, topo->node_count ) ) || job.failed ) {
+        fprintf( stderr, "Failed to prepare topology.\n" );
+        return 1;
+    }
+
+    return 0;
+}
+
+
+/*
+ * Segment lists and routing headers
+ */
+
+/* Turn the hop-by-hop path to dst into the shortest list of segments that
+ * plain shortest path forwarding will steer along that exact path.  From the
+ * current position, the furthest hop reachable over a unique IGP shortest
+ * path that matches the computed path gets a node segment; when not even the
+ * next hop qualifies, the link's adjacency segment is used.
+ *
+ * Return: The number of segments, or -1 if the path cannot be encoded
+ */
+static int minimize_segments( const sr_topology *topo, spf_scratch *s, int dst,
+        int *hop_count ) {
+    int n = topo->node_count;
+    int k = 0;
+
+    // Walk the predecessors back to the source, then reverse into hops[]
+    for ( int v = dst; v != -1; v = s->pred_node[v] )
+        s->hops[k++] = v;
+    for ( int i = 0; i < k / 2; i++ ) {
+        int temp = s->hops[i];
+        s->hops[i] = s->hops[k - 1 - i];
+        s->hops[k - 1 - i] = temp;
+    }
+    *hop_count = k - 1;
+
+    int segment_count = 0;
+    int cur = 0;
+    int last_was_adjacency = 0;
+
+    while ( cur < k - 1 ) {
+        int from = s->hops[cur];
+        const uint32_t *dist = topo->igp_dist + (size_t)from * n;
+        const uint8_t *ecmp = topo->igp_ecmp + (size_t)from * n;
+        int best = -1;
+
+        for ( int j = k - 1; j > cur; j-- ) {
+            int to = s->hops[j];
+            uint32_t path_metric = s->metric_sum[to] - s->metric_sum[from];
+            if ( dist[to] == path_metric && !ecmp[to] ) {
+                best = j;
+                break;
+            }
+        }
+
+        if ( segment_count == SR_PATH_MAX_SEGMENTS )
+            return -1;
+
+        if ( best != -1 ) {
+            s->segments[segment_count++] = topo->sids[s->hops[best]];
+            cur = best;
+            last_was_adjacency = 0;
+        } else {
+            int link = s->pred_link[s->hops[cur + 1]];
+            if ( !topo->has_adj_sid[link] )
+                return -1;
+            s->segments[segment_count++] = topo->adj_sids[link];
+            cur++;
+            last_was_adjacency = 1;
+        }
+    }
+
+    // The last segment must always be the destination address
+    if ( 0 == segment_count || last_was_adjacency ) {
+        if ( segment_count == SR_PATH_MAX_SEGMENTS )
+            return -1;
+        s->segments[segment_count++] = topo->sids[dst];
+    }
+
+    return segment_count;
+}
+
+/* Build a Type-4 routing header holding the segments in travel order */
+static void *build_srh( const struct in6_addr *segments, int count, socklen_t *len ) {
+    *len = inet6_rth_space_n( IPV6_RTHDR_TYPE_4, count );
+    if ( 0 == *len )
+        return NULL;
+
+    void *hdr = malloc( *len );
+    if ( NULL == hdr )
+        return NULL;
+
+    if ( NULL == inet6_rth_init_n( hdr, *len, IPV6_RTHDR_TYPE_4, count ) ) {
+        free( hdr );
+        return NULL;
+    }
+
+    // The header stores the last segment first
+    for ( int i = count - 1; i >= 0; i-- ) {
+        if ( inet6_rth_add_n( hdr, &segments[i] ) ) {
+            free( hdr );
+            return NULL;
+        }
+    }
+
+    struct ip6_rthdr4 *rthdr = (struct ip6_rthdr4*)hdr;
+    rthdr->ip6r4_segleft = count - 1;
+    rthdr->ip6r4_lastentry = count - 1;
+
+    return hdr;
+}
+
+static void emit_result( const sr_topology *topo, spf_scratch *s, int dst,
+        sr_path_result *result ) {
+    result->metric = s->metric_sum[dst];
+    result->latency = s->latency_sum[dst];
+
+    int count = minimize_segments( topo, s, dst, &result->hop_count );
+    if ( count < 0 ) {
+        result->status = SR_PATH_NO_ENCODING;
+        return;
+    }
+
+    result->srh = build_srh( s->segments, count, &result->srh_len );
+    if ( NULL == result->srh ) {
+        result->status = SR_PATH_NO_ENCODING;
+        return;
+    }
+    result->segment_count = count;
+    result->status = SR_PATH_OK;
+}
+
+
+/*
+ * Batched computation
+ */
+
+/* Requests sorted so those sharing a source and constraints are adjacent */
+struct request_ref {
+    int src;
+    uint32_t max_latency;
+    uint32_t include_any;
+    uint32_t exclude_any;
+    int index;
+};
+
+static int request_ref_cmp( const void *a, const void *b ) {
+    const struct request_ref *x = a, *y = b;
+    if ( x->src != y->src )
+        return x->src < y->src ? -1 : 1;
+    if ( x->max_latency != y->max_latency )
+        return x->max_latency < y->max_latency ? -1 : 1;
+    if ( x->include_any != y->include_any )
+        return x->include_any < y->include_any ? -1 : 1;
+    if ( x->exclude_any != y->exclude_any )
+        return x->exclude_any < y->exclude_any ? -1 : 1;
+    return x->index - y->index;
+}
+
+static int same_group( const struct request_ref *x, const struct request_ref *y ) {
+    return x->src == y->src && x->max_latency == y->max_latency &&
+        x->include_any == y->include_any && x->exclude_any == y->exclude_any;
+}
+
+struct batch_job {
+    const sr_topology *topo;
+    const sr_path_request *reqs;
+    sr_path_result *results;
+    const struct request_ref *refs;
+    const int *group_start;  /* group_count + 1 offsets into refs */
+    int group_count;
+    int next;
+    int failed;
+};
+
+static void solve_group( const struct batch_job *job, spf_scratch *s,
+        const struct request_ref *first, const struct request_ref *end ) {
+    const sr_topology *topo = job->topo;
+    int pending = 0;
+
+    spf_constrained( topo, s, first->src, first->include_any, first->exclude_any );
+
+    for ( const struct request_ref *ref = first; ref != end; ref++ ) {
+        sr_path_result *result = &job->results[ref->index];
+        int dst = job->reqs[ref->index].dst;
+
+        if ( UINT64_MAX == s->key[dst] ) {
+            result->status = SR_PATH_NO_PATH;
+        } else if ( ref->max_latency && s->latency_sum[dst] > ref->max_latency ) {
+            // The cheapest path is too slow, search within the bound below
+            pending++;
+        } else {
+            emit_result( topo, s, dst, result );
+        }
+    }
+
+    if ( 0 == pending )
+        return;
+
+    if ( spf_latency_bounded( topo, s, first->src, first->max_latency,
+                first->include_any, first->exclude_any ) )
+        fprintf( stderr, "Latency bounded search from `%s` hit its label limit, some paths may be missing.\n",
+                topo->names[first->src] );
+
+    // Unreachable destinations have no label either, so anything still
+    // without a path here and with a label is one of the pending requests
+    for ( const struct request_ref *ref = first; ref != end; ref++ ) {
+        sr_path_result *result = &job->results[ref->index];
+        int dst = job->reqs[ref->index].dst;
+
+        if ( result->status != SR_PATH_NO_PATH || NULL != result->srh ||
+                -1 == s->first_label[dst] )
+            continue;
+
+        label_to_path( s, s->first_label[dst] );
+        emit_result( topo, s, dst, result );
+    }
+}
+
+static void *batch_worker( void *arg ) {
+    struct batch_job *job = arg;
+    spf_scratch *s = scratch_alloc( job->topo );
+
+    if ( !scratch_ok( s ) ) {
+        __atomic_store_n( &job->failed, 1, __ATOMIC_RELAXED );
+        scratch_free( s );
+        return NULL;
+    }
+
+    int group;
+    while ( (group = __atomic_fetch_add( &job->next, 1, __ATOMIC_RELAXED )) < job->group_count )
+        solve_group( job, s, &job->refs[job->group_start[group]],
+                &job->refs[job->group_start[group + 1]] );
+
+    scratch_free( s );
+    return NULL;
+}
+
+int sr_path_compute_batch( sr_topology *topo,
+        const sr_path_request *reqs,
+        sr_path_result *results,
+        int count,
+        int nthreads ) {
+
+    if ( count <= 0 )
+        return 0;
+
+    if ( NULL == topo->igp_dist && sr_topology_prepare( topo, nthreads ) )
+        return 1;
+
+    struct request_ref *refs = malloc( count * sizeof *refs );
+    int *group_start = malloc( (count + 1) * sizeof *group_start );
+    if ( NULL == refs || NULL == group_start ) {
+        fprintf( stderr, "Out of memory computing paths.\n" );
+        free( refs );
+        free( group_start );
+        return 1;
+    }
+
+    // Every result starts out as "no path" so that requests a worker never
+    // gets to (bad indices, failed allocations) are still well defined
+    int valid = 0;
+    for ( int i = 0; i < count; i++ ) {
+        memset( &results[i], 0, sizeof results[i] );
+        results[i].status = SR_PATH_NO_PATH;
+
+        if ( reqs[i].src < 0 || reqs[i].src >= topo->node_count ||
+                reqs[i].dst < 0 || reqs[i].dst >= topo->node_count ) {
+            results[i].status = SR_PATH_BAD_REQUEST;
+            continue;
+        }
+
+        refs[valid].src = reqs[i].src;
+        refs[valid].max_latency = reqs[i].max_latency;
+        refs[valid].include_any = reqs[i].include_any;
+        refs[valid].exclude_any = reqs[i].exclude_any;
+        refs[valid].index = i;
+        valid++;
+    }
+
+    qsort( refs, valid, sizeof *refs, request_ref_cmp );
+
+    int group_count = 0;
+    for ( int i = 0; i < valid; i++ )
+        if ( 0 == i || !same_group( &refs[i - 1], &refs[i] ) )
+            group_start[group_count++] = i;
+    group_start[group_count] = valid;
+
+    struct batch_job job = { topo, reqs, results, refs, group_start, group_count, 0, 0 };
+    int res = 0;
+    if ( group_count > 0 &&
+            (run_parallel( batch_worker, &job, resolve_threads( nthreads, group_count ) ) || job.failed) ) {
+        fprintf( stderr, "Failed to compute paths.\n" );
+        res = 1;
+    }
+
+    free( refs );
+    free( group_start );
+    return res;
+}
+
+void sr_path_result_free( sr_path_result *result ) {
+    free( result->srh );
+    result->srh = NULL;
+    result->srh_len = 0;
+    result->segment_count = 0;
+}
+
+int sr_path_write_segments( FILE *file, const void *srh ) {
+    int num_segments = inet6_rth_segments_n( srh );
+    if ( num_segments < 0 )
+        return 1;
+
+    fprintf( file, "# Specify SIDs (addresses) below, in reverse order (ie last segment first).\n" );
+    fprintf( file, "# Note that the last segment MUST be the destination address.\n\n" );
+
+    for ( int i = 0; i < num_segments; i++ ) {
+        char addr_str[INET6_ADDRSTRLEN];
+        struct in6_addr addr;
+        memcpy( &addr, inet6_rth_getaddr_n( srh, i ), sizeof addr );
+        if ( NULL == inet_ntop( AF_INET6, &addr, addr_str, INET6_ADDRSTRLEN ) )
+            return 1;
+        fprintf( file, "%s\n", addr_str );
+    }
+
+    return ferror( file ) ? 1 : 0;
+}
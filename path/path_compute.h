@@ -0,0 +1,164 @@
+/* Constrained shortest path computation for SRv6 segment lists
+ *
+ * A topology file is loaded into a compressed sparse row (CSR) graph, paths
+ * are computed for batches of source/destination pairs across several
+ * threads, and each path is minimized into a segment list and emitted as a
+ * ready-built Type-4 routing header.
+ *
+ * Topology file format (one entry per line, # starts a comment):
+ *
+ *   node <name> <sid>
+ *   link <from> <to> <metric> <latency> <affinity> [adjacency sid]
+ *
+ * Links are directional, so a bidirectional link needs two lines.  Metrics
+ * must be at least one, latency is in whatever unit the caller uses for
+ * constraints (microseconds by convention) and affinity is a 32 bit mask of
+ * administrative groups (e.g. 0x5).
+ */
+#ifndef __SR_PATH_COMPUTE_H__
+#define __SR_PATH_COMPUTE_H__
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include "sr_api.h"
+
+/* The largest segment list that fits in a Type-4 routing header */
+#define SR_PATH_MAX_SEGMENTS IPV6_RTHDR4_MAX_SEGMENTS
+
+/* Status codes stored in sr_path_result.status */
+#define SR_PATH_OK          0
+#define SR_PATH_NO_PATH     1  /* Nothing satisfies the constraints */
+#define SR_PATH_NO_ENCODING 2  /* Path needs an adjacency SID that is missing,
+                                  or more than SR_PATH_MAX_SEGMENTS segments */
+#define SR_PATH_BAD_REQUEST 3  /* Unknown source or destination node */
+
+/* A topology stored as a CSR graph.  The outgoing links of node n are the
+ * indices row[n] up to (but not including) row[n+1] of the per-link arrays.
+ */
+struct sr_topology {
+    int node_count;
+    int link_count;
+
+    char **names;
+    struct in6_addr *sids;
+
+    /* Open addressing hash of node names, name_slot_count is a power of two
+     * and empty slots hold -1 */
+    int *name_slots;
+    int name_slot_count;
+
+    uint32_t *row;
+    uint32_t *col;
+    uint32_t *metric;
+    uint32_t *latency;
+    uint32_t *affinity;
+    struct in6_addr *adj_sids;
+    uint8_t *has_adj_sid;
+
+    /* Unconstrained (IGP) distances between every pair of nodes, and whether
+     * more than one shortest path exists.  Filled in by sr_topology_prepare
+     * and used to decide which hops of a path need an explicit segment. */
+    uint32_t *igp_dist;
+    uint8_t *igp_ecmp;
+};
+typedef struct sr_topology sr_topology;
+
+/* A single path computation request.  Constraints set to zero are ignored. */
+struct sr_path_request {
+    int src;
+    int dst;
+    uint32_t max_latency;  /* Upper bound on the summed link latency */
+    uint32_t include_any;  /* Only use links sharing a bit with this mask */
+    uint32_t exclude_any;  /* Never use links sharing a bit with this mask */
+};
+typedef struct sr_path_request sr_path_request;
+
+/* The outcome of a path computation request.  When status is SR_PATH_OK,
+ * srh points to a malloc'd routing header of srh_len bytes holding
+ * segment_count segments, ready for setsockopt( IPV6_RTHDR ).
+ */
+struct sr_path_result {
+    int status;
+    uint32_t metric;
+    uint32_t latency;
+    int hop_count;
+    int segment_count;
+    void *srh;
+    socklen_t srh_len;
+};
+typedef struct sr_path_result sr_path_result;
+
+/* Load a topology file into a CSR graph
+ * Args:
+ * file - File pointer for the topology file
+ *
+ * Return: The loaded topology on success, or NULL on failure
+ */
+sr_topology *sr_topology_load( FILE *file );
+
+/* Release a topology and everything it owns
+ * Args:
+ * topo - The topology to free, or a null pointer
+ */
+void sr_topology_free( sr_topology *topo );
+
+/* Look up a node by name
+ * Args:
+ * topo - The topology to search
+ * name - The node name
+ *
+ * Return: The node index, or -1 if the name is unknown
+ */
+int sr_topology_find( const sr_topology *topo, const char *name );
+
+/* Compute the unconstrained shortest path tables used for segment list
+ * minimization.  This costs one shortest path run per node and O(n^2) memory,
+ * and is done automatically by sr_path_compute_batch if it has not been done
+ * yet.
+ * Args:
+ * topo     - The topology to prepare
+ * nthreads - Number of worker threads, or <= 0 to use every online core
+ *
+ * Return: Zero on success, nonzero on failure
+ */
+int sr_topology_prepare( sr_topology *topo, int nthreads );
+
+/* Compute constrained shortest paths for many requests in parallel.  Requests
+ * sharing a source and constraints are solved by a single shortest path run.
+ * Paths minimize the summed metric (then latency) among the paths that meet
+ * the latency bound; when the cheapest path breaks the bound, an exact
+ * latency bounded search finds the cheapest one that does not.
+ * Args:
+ * topo     - The topology to compute over
+ * reqs     - Array of count requests
+ * results  - Array of count results, filled in by this function
+ * count    - The number of requests
+ * nthreads - Number of worker threads, or <= 0 to use every online core
+ *
+ * Return: Zero if the batch ran (check each result's status), nonzero on
+ * failure
+ */
+int sr_path_compute_batch( sr_topology *topo,
+        const sr_path_request *reqs,
+        sr_path_result *results,
+        int count,
+        int nthreads );
+
+/* Release the routing header held by a result
+ * Args:
+ * result - The result to clear
+ */
+void sr_path_result_free( sr_path_result *result );
+
+/* Write the segments of a routing header in the format read by
+ * build_srh_from_file (last segment first, one per line)
+ * Args:
+ * file - The file pointer to write to
+ * srh  - The routing header to write out
+ *
+ * Return: Zero on success, nonzero on failure
+ */
+int sr_path_write_segments( FILE *file, const void *srh );
+#endif
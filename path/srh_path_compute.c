@@ -0,0 +1,221 @@
+/* Computes segment lists from a topology file.
+ *
+ * With a source and destination, the constrained shortest path between them
+ * is minimized into a segment list and written out in the segments.txt format
+ * read by the ping server.  Without them, paths between every pair of nodes
+ * are recomputed as they would be after a topology event, and the time taken
+ * is reported.
+ *
+ * Args: -t : Topology file
+ *       -s : Source node name
+ *       -d : Destination node name
+ *       -l : Maximum path latency (0 for none)
+ *       -i : Affinity bits a link must share to be used (0 for none)
+ *       -x : Affinity bits a link must not have
+ *       -j : Number of threads (default: every online core)
+ *       -o : Output file for the segment list (default: stdout)
+ *
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "path_compute.h"
+#include "ping_common.h"
+#include "sr_api.h"
+
+
+static double now_sec() {
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int compute_single(sr_topology *topo, sr_path_request *req, const char *out_path, int nthreads);
+static int compute_all_pairs(sr_topology *topo, sr_path_request *req, int nthreads);
+
+
+int main(int argc, char **argv) {
+    const char *topo_path = NULL, *src_name = NULL, *dst_name = NULL;
+    const char *out_path = NULL;
+    sr_path_request req;
+    int nthreads = 0;
+    int c;
+
+    memset( &req, 0, sizeof req );
+
+    while ( (c = getopt( argc, argv, "t:s:d:l:i:x:j:o:" )) != -1 ) {
+        switch( c ) {
+        case 't':
+            topo_path = optarg;
+            break;
+        case 's':
+            src_name = optarg;
+            break;
+        case 'd':
+            dst_name = optarg;
+            break;
+        case 'l':
+            req.max_latency = strtoul( optarg, NULL, 0 );
+            break;
+        case 'i':
+            req.include_any = strtoul( optarg, NULL, 0 );
+            break;
+        case 'x':
+            req.exclude_any = strtoul( optarg, NULL, 0 );
+            break;
+        case 'j':
+            nthreads = strtol( optarg, NULL, 10 );
+            break;
+        case 'o':
+            out_path = optarg;
+            break;
+        case '?':
+            return 1;
+        default:
+            abort ();
+        }
+    }
+
+    if ( NULL == topo_path || (NULL == src_name) != (NULL == dst_name) ) {
+        fprintf( stderr, "Usage: %s -t topology [-s source -d destination] [-l max_latency] [-i include_any] [-x exclude_any] [-j threads] [-o output]\n", argv[0] );
+        return 1;
+    }
+
+    FILE *topo_file = fopen( topo_path, "r" );
+    if ( NULL == topo_file ) {
+        fprintf( stderr, "Error opening topology file `%s`\n", topo_path );
+        return 1;
+    }
+
+    double start = now_sec();
+    sr_topology *topo = sr_topology_load( topo_file );
+    fclose( topo_file );
+    if ( NULL == topo ) {
+        fprintf( stderr, "Failed to load topology.\n" );
+        return 1;
+    }
+    fprintf( stderr, "Loaded %d nodes and %d links in %.3f ms\n",
+            topo->node_count, topo->link_count, (now_sec() - start) * 1e3 );
+
+    int res;
+    if ( NULL != src_name ) {
+        req.src = sr_topology_find( topo, src_name );
+        req.dst = sr_topology_find( topo, dst_name );
+        if ( req.src < 0 || req.dst < 0 ) {
+            fprintf( stderr, "Unknown node `%s`\n", req.src < 0 ? src_name : dst_name );
+            sr_topology_free( topo );
+            return 1;
+        }
+        res = compute_single( topo, &req, out_path, nthreads );
+    } else {
+        res = compute_all_pairs( topo, &req, nthreads );
+    }
+
+    sr_topology_free( topo );
+    return res;
+}
+
+static int compute_single(sr_topology *topo, sr_path_request *req, const char *out_path, int nthreads) {
+    sr_path_result result;
+
+    if ( sr_path_compute_batch( topo, req, &result, 1, nthreads ) )
+        return 1;
+
+    switch ( result.status ) {
+    case SR_PATH_OK:
+        break;
+    case SR_PATH_NO_ENCODING:
+        fprintf( stderr, "Path cannot be encoded, an adjacency SID is missing or it needs more than %d segments.\n",
+                SR_PATH_MAX_SEGMENTS );
+        return 1;
+    default:
+        fprintf( stderr, "No path satisfies the constraints.\n" );
+        return 1;
+    }
+
+    fprintf( stderr, "Path: %d hops, metric %u, latency %u, %d segments\n",
+            result.hop_count, result.metric, result.latency, result.segment_count );
+    fprintf( stderr, "Hex dump of routing header:\n" );
+    hex_print( result.srh, result.srh_len );
+
+    FILE *out = stdout;
+    if ( NULL != out_path && NULL == (out = fopen( out_path, "w" )) ) {
+        fprintf( stderr, "Error opening output file `%s`\n", out_path );
+        sr_path_result_free( &result );
+        return 1;
+    }
+
+    int res = sr_path_write_segments( out, result.srh );
+    if ( out != stdout )
+        res |= fclose( out );
+
+    sr_path_result_free( &result );
+    return res;
+}
+
+static int compute_all_pairs(sr_topology *topo, sr_path_request *req, int nthreads) {
+    int n = topo->node_count;
+    long count = (long)n * (n - 1);
+
+    if ( count <= 0 || count > INT32_MAX ) {
+        fprintf( stderr, "Topology is too small or too large to compute every pair.\n" );
+        return 1;
+    }
+
+    sr_path_request *reqs = malloc( count * sizeof *reqs );
+    sr_path_result *results = malloc( count * sizeof *results );
+    if ( NULL == reqs || NULL == results ) {
+        fprintf( stderr, "Out of memory.\n" );
+        free( reqs );
+        free( results );
+        return 1;
+    }
+
+    long i = 0;
+    for ( int s = 0; s < n; s++ ) {
+        for ( int d = 0; d < n; d++ ) {
+            if ( s == d )
+                continue;
+            reqs[i] = *req;
+            reqs[i].src = s;
+            reqs[i].dst = d;
+            i++;
+        }
+    }
+
+    double start = now_sec();
+    if ( sr_topology_prepare( topo, nthreads ) ) {
+        free( reqs );
+        free( results );
+        return 1;
+    }
+    double prepared = now_sec();
+    int res = sr_path_compute_batch( topo, reqs, results, count, nthreads );
+    double done = now_sec();
+
+    long ok = 0, no_path = 0, no_encoding = 0, segments = 0;
+    for ( i = 0; i < count; i++ ) {
+        if ( results[i].status == SR_PATH_OK ) {
+            ok++;
+            segments += results[i].segment_count;
+        } else if ( results[i].status == SR_PATH_NO_ENCODING ) {
+            no_encoding++;
+        } else {
+            no_path++;
+        }
+        sr_path_result_free( &results[i] );
+    }
+
+    printf( "pairs %ld ok %ld no_path %ld no_encoding %ld avg_segments %.2f\n",
+            count, ok, no_path, no_encoding, ok ? (double)segments / ok : 0.0 );
+    printf( "prepare_ms %.3f compute_ms %.3f total_ms %.3f\n",
+            (prepared - start) * 1e3, (done - prepared) * 1e3, (done - start) * 1e3 );
+
+    free( reqs );
+    free( results );
+    return res;
+}
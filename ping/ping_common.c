@@ -107,7 +107,12 @@ void *build_srh_from_file(FILE *file) {
     void *hdr = malloc( hdr_size );
 
     // Initialize the header
-    inet6_rth_init_n( hdr, hdr_size, IPV6_RTHDR_TYPE_4, str_count );
+    if ( NULL == hdr || NULL == inet6_rth_init_n( hdr, hdr_size, IPV6_RTHDR_TYPE_4, str_count ) ) {
+        fprintf( stderr, "A routing header holds at most %d segments, got %d.\n",
+                IPV6_RTHDR4_MAX_SEGMENTS, str_count );
+        free( hdr );
+        return NULL;
+    }
 
     struct ip6_rthdr4 *rthdr = (struct ip6_rthdr4*)hdr;
 
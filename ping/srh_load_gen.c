@@ -0,0 +1,556 @@
+/* Connection load generator for benchmarking the accept rate and per
+ * connection segment routing setup cost of a server (such as the SRH ping
+ * server).
+ *
+ * Each thread opens non-blocking connections at its share of the target rate,
+ * keeping at most its share of the concurrency in flight, and waits on them
+ * with epoll.  For every connection it measures the time to establish it and
+ * the time from then until the first byte (the server's first SRH-routed
+ * segment) arrives.  With -s, the client also sets a routing header on each
+ * socket before connecting and the cost of that setsockopt is measured.
+ *
+ * Results are printed as latency histograms, followed by a one line JSON
+ * summary for scripts.
+ *
+ * Args: -a : The IPv6 address of the server
+ *       -p : The server port
+ *       -r : Target connection rate per second across all threads (0 for as
+ *            fast as possible, the default)
+ *       -c : Maximum connections in flight across all threads (default 64)
+ *       -t : Number of threads (default 1)
+ *       -n : Total number of connections (default 10000)
+ *       -d : Run for this many seconds instead of a fixed number of
+ *            connections
+ *       -T : First byte timeout in milliseconds (default 1000)
+ *       -s : Segment file for a client-side routing header
+ *       -o : Write the JSON summary to this file instead of stdout
+ *
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include <arpa/inet.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+
+#include "ping_common.h"
+#include "sr_api.h"
+
+/* Log-linear histogram: values below HIST_SUB are exact, above that every
+ * power of two is split into HIST_SUB buckets (about 6% resolution) */
+#define HIST_SUB_BITS 4
+#define HIST_SUB (1 << HIST_SUB_BITS)
+#define HIST_BUCKETS (64 << HIST_SUB_BITS)
+
+#define EPOLL_BATCH 256
+
+/* Connection slot states */
+#define SLOT_FREE       0
+#define SLOT_CONNECTING 1
+#define SLOT_WAITING    2
+
+struct latency_hist {
+    uint64_t counts[HIST_BUCKETS];
+    uint64_t total;
+    uint64_t sum;
+    uint64_t min;
+    uint64_t max;
+};
+typedef struct latency_hist latency_hist;
+
+struct load_stats {
+    latency_hist connect;
+    latency_hist first_byte;
+    latency_hist srh_setup;
+    uint64_t started;
+    uint64_t completed;
+    uint64_t connect_errors;
+    uint64_t srh_errors;
+    uint64_t recv_errors;
+    uint64_t timeouts;
+};
+typedef struct load_stats load_stats;
+
+struct conn_slot {
+    int fd;
+    int state;
+    uint64_t started_ns;
+    uint64_t established_ns;
+};
+
+/* Settings shared by all threads, plus each thread's share of the work */
+struct load_config {
+    struct sockaddr_in6 server;
+    const void *srh;
+    socklen_t srh_len;
+    double rate;
+    int concurrency;
+    uint64_t connections;
+    uint64_t duration_ns;
+    uint64_t timeout_ns;
+};
+typedef struct load_config load_config;
+
+struct load_thread {
+    pthread_t thread;
+    const load_config *config;
+    double rate;
+    int concurrency;
+    uint64_t quota;
+    load_stats stats;
+};
+
+
+static uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static int hist_bucket( uint64_t value ) {
+    if ( value < HIST_SUB )
+        return value;
+
+    int msb = 63 - __builtin_clzll( value );
+    int shift = msb - HIST_SUB_BITS;
+    return ((shift + 1) << HIST_SUB_BITS) + ((value >> shift) & (HIST_SUB - 1));
+}
+
+static uint64_t hist_bucket_low( int bucket ) {
+    if ( bucket < HIST_SUB )
+        return bucket;
+
+    int shift = (bucket >> HIST_SUB_BITS) - 1;
+    return (uint64_t)(HIST_SUB + (bucket & (HIST_SUB - 1))) << shift;
+}
+
+static void hist_record( latency_hist *hist, uint64_t value ) {
+    hist->counts[hist_bucket( value )]++;
+    if ( 0 == hist->total || value < hist->min )
+        hist->min = value;
+    if ( value > hist->max )
+        hist->max = value;
+    hist->total++;
+    hist->sum += value;
+}
+
+static void hist_merge( latency_hist *into, const latency_hist *from ) {
+    if ( 0 == from->total )
+        return;
+    for ( int b = 0; b < HIST_BUCKETS; b++ )
+        into->counts[b] += from->counts[b];
+    if ( 0 == into->total || from->min < into->min )
+        into->min = from->min;
+    if ( from->max > into->max )
+        into->max = from->max;
+    into->total += from->total;
+    into->sum += from->sum;
+}
+
+static uint64_t hist_percentile( const latency_hist *hist, double pct ) {
+    if ( 0 == hist->total )
+        return 0;
+
+    uint64_t rank = (uint64_t)(pct / 100.0 * hist->total + 0.5);
+    if ( rank < 1 )
+        rank = 1;
+
+    uint64_t seen = 0;
+    for ( int b = 0; b < HIST_BUCKETS; b++ ) {
+        seen += hist->counts[b];
+        if ( seen >= rank ) {
+            uint64_t low = hist_bucket_low( b );
+            return low > hist->max ? hist->max : (low < hist->min ? hist->min : low);
+        }
+    }
+    return hist->max;
+}
+
+/* Print a histogram with one row per power of two of microseconds */
+static void hist_print( const char *title, const latency_hist *hist ) {
+    uint64_t rows[64] = { 0 };
+    uint64_t widest = 0;
+    int first = 64, last = -1;
+
+    printf( "%s: %llu samples", title, (unsigned long long)hist->total );
+    if ( 0 == hist->total ) {
+        printf( "\n\n" );
+        return;
+    }
+    printf( ", min %.1f us, mean %.1f us, p50 %.1f us, p99 %.1f us, max %.1f us\n",
+            hist->min / 1e3, (double)hist->sum / hist->total / 1e3,
+            hist_percentile( hist, 50 ) / 1e3, hist_percentile( hist, 99 ) / 1e3,
+            hist->max / 1e3 );
+
+    for ( int b = 0; b < HIST_BUCKETS; b++ ) {
+        if ( 0 == hist->counts[b] )
+            continue;
+        uint64_t us = hist_bucket_low( b ) / 1000;
+        int row = us ? 64 - __builtin_clzll( us ) : 0;
+        rows[row] += hist->counts[b];
+        if ( rows[row] > widest )
+            widest = rows[row];
+        if ( row < first )
+            first = row;
+        if ( row > last )
+            last = row;
+    }
+
+    for ( int row = first; row <= last; row++ ) {
+        uint64_t low = row ? 1ull << (row - 1) : 0;
+        int bar = (int)(rows[row] * 50 / widest);
+        printf( "  %8llu us | %-50.*s %llu\n", (unsigned long long)low, bar,
+                "##################################################",
+                (unsigned long long)rows[row] );
+    }
+    printf( "\n" );
+}
+
+static void hist_print_json( FILE *out, const char *name, const latency_hist *hist ) {
+    fprintf( out, "\"%s\":{\"count\":%llu,\"min_ns\":%llu,\"mean_ns\":%llu,"
+            "\"p50_ns\":%llu,\"p90_ns\":%llu,\"p99_ns\":%llu,\"p999_ns\":%llu,\"max_ns\":%llu}",
+            name,
+            (unsigned long long)hist->total,
+            (unsigned long long)hist->min,
+            (unsigned long long)(hist->total ? hist->sum / hist->total : 0),
+            (unsigned long long)hist_percentile( hist, 50 ),
+            (unsigned long long)hist_percentile( hist, 90 ),
+            (unsigned long long)hist_percentile( hist, 99 ),
+            (unsigned long long)hist_percentile( hist, 99.9 ),
+            (unsigned long long)hist->max );
+}
+
+
+static void slot_close( int epfd, struct conn_slot *slot ) {
+    epoll_ctl( epfd, EPOLL_CTL_DEL, slot->fd, NULL );
+    close( slot->fd );
+    slot->fd = -1;
+    slot->state = SLOT_FREE;
+}
+
+/* Start a non-blocking connection in a free slot
+ * Return: Zero if the connection is in flight, nonzero if it failed
+ */
+static int slot_start( struct load_thread *lt, int epfd, struct conn_slot *slot, uint32_t index ) {
+    const load_config *config = lt->config;
+    load_stats *stats = &lt->stats;
+
+    stats->started++;
+    slot->started_ns = now_ns();
+
+    int fd = socket( AF_INET6, SOCK_STREAM | SOCK_NONBLOCK, 0 );
+    if ( fd < 0 ) {
+        stats->connect_errors++;
+        return 1;
+    }
+
+    if ( NULL != config->srh ) {
+        uint64_t before = now_ns();
+        if ( setsockopt( fd, IPPROTO_IPV6, IPV6_RTHDR, config->srh, config->srh_len ) < 0 ) {
+            stats->srh_errors++;
+            close( fd );
+            return 1;
+        }
+        hist_record( &stats->srh_setup, now_ns() - before );
+    }
+
+    if ( connect( fd, (struct sockaddr*)&config->server, sizeof config->server ) < 0 &&
+            errno != EINPROGRESS ) {
+        stats->connect_errors++;
+        close( fd );
+        return 1;
+    }
+
+    struct epoll_event ev;
+    ev.events = EPOLLOUT;
+    ev.data.u32 = index;
+    if ( epoll_ctl( epfd, EPOLL_CTL_ADD, fd, &ev ) < 0 ) {
+        stats->connect_errors++;
+        close( fd );
+        return 1;
+    }
+
+    slot->fd = fd;
+    slot->state = SLOT_CONNECTING;
+    return 0;
+}
+
+static void slot_event( struct load_thread *lt, int epfd, struct conn_slot *slot,
+        uint32_t index, uint32_t events ) {
+    load_stats *stats = &lt->stats;
+    uint64_t now = now_ns();
+
+    if ( SLOT_CONNECTING == slot->state ) {
+        int err = 0;
+        socklen_t err_len = sizeof err;
+        if ( getsockopt( slot->fd, SOL_SOCKET, SO_ERROR, &err, &err_len ) < 0 || err != 0 ) {
+            stats->connect_errors++;
+            slot_close( epfd, slot );
+            return;
+        }
+
+        hist_record( &stats->connect, now - slot->started_ns );
+        slot->established_ns = now;
+        slot->state = SLOT_WAITING;
+
+        struct epoll_event ev;
+        ev.events = EPOLLIN | EPOLLRDHUP;
+        ev.data.u32 = index;
+        if ( epoll_ctl( epfd, EPOLL_CTL_MOD, slot->fd, &ev ) < 0 ) {
+            stats->recv_errors++;
+            slot_close( epfd, slot );
+        }
+        return;
+    }
+
+    char buf[64];
+    ssize_t got = recv( slot->fd, buf, sizeof buf, 0 );
+    if ( got > 0 ) {
+        hist_record( &stats->first_byte, now - slot->established_ns );
+        stats->completed++;
+    } else if ( got < 0 && (errno == EAGAIN || errno == EWOULDBLOCK) && !(events & (EPOLLERR | EPOLLHUP | EPOLLRDHUP)) ) {
+        return;
+    } else {
+        stats->recv_errors++;
+    }
+    slot_close( epfd, slot );
+}
+
+static void *load_thread_run( void *arg ) {
+    struct load_thread *lt = arg;
+    const load_config *config = lt->config;
+    struct epoll_event events[EPOLL_BATCH];
+
+    struct conn_slot *slots = malloc( lt->concurrency * sizeof *slots );
+    int epfd = epoll_create1( 0 );
+    if ( NULL == slots || epfd < 0 ) {
+        fprintf( stderr, "Error setting up load thread.\n" );
+        free( slots );
+        return NULL;
+    }
+    for ( int i = 0; i < lt->concurrency; i++ ) {
+        slots[i].fd = -1;
+        slots[i].state = SLOT_FREE;
+    }
+
+    uint64_t start = now_ns();
+    uint64_t interval = lt->rate > 0 ? (uint64_t)(1e9 / lt->rate) : 0;
+    uint64_t next_start = start;
+    uint64_t stop_starting = config->duration_ns ? start + config->duration_ns : UINT64_MAX;
+    int in_flight = 0;
+    int free_hint = 0;
+
+    while ( 1 ) {
+        uint64_t now = now_ns();
+        int may_start = lt->stats.started < lt->quota && now < stop_starting;
+
+        // Start as many connections as the schedule and concurrency allow
+        while ( may_start && in_flight < lt->concurrency && now >= next_start &&
+                lt->stats.started < lt->quota ) {
+            while ( slots[free_hint].state != SLOT_FREE )
+                free_hint = (free_hint + 1) % lt->concurrency;
+            if ( 0 == slot_start( lt, epfd, &slots[free_hint], free_hint ) )
+                in_flight++;
+            next_start += interval;
+        }
+
+        if ( 0 == in_flight && !(lt->stats.started < lt->quota && now < stop_starting) )
+            break;
+
+        int timeout_ms = 1;
+        if ( 0 == in_flight && next_start > now )
+            timeout_ms = (int)((next_start - now) / 1000000) + 1;
+
+        int ready = epoll_wait( epfd, events, EPOLL_BATCH, timeout_ms );
+        for ( int e = 0; e < ready; e++ ) {
+            uint32_t index = events[e].data.u32;
+            slot_event( lt, epfd, &slots[index], index, events[e].events );
+            if ( SLOT_FREE == slots[index].state )
+                in_flight--;
+        }
+
+        // Expire connections the server never answered
+        now = now_ns();
+        for ( int i = 0; i < lt->concurrency && in_flight > 0; i++ ) {
+            if ( SLOT_FREE != slots[i].state && now - slots[i].started_ns > config->timeout_ns ) {
+                lt->stats.timeouts++;
+                slot_close( epfd, &slots[i] );
+                in_flight--;
+            }
+        }
+    }
+
+    close( epfd );
+    free( slots );
+    return NULL;
+}
+
+
+int main(int argc, char **argv) {
+    load_config config;
+    const char *addr_str = NULL, *port_str = NULL;
+    const char *segment_path = NULL, *out_path = NULL;
+    int threads = 1;
+    int c;
+
+    memset( &config, 0, sizeof config );
+    config.concurrency = 64;
+    config.connections = 10000;
+    config.timeout_ns = 1000 * 1000000ull;
+
+    while ( (c = getopt( argc, argv, "a:p:r:c:t:n:d:T:s:o:" )) != -1 ) {
+        switch( c ) {
+        case 'a':
+            addr_str = optarg;
+            break;
+        case 'p':
+            port_str = optarg;
+            break;
+        case 'r':
+            config.rate = strtod( optarg, NULL );
+            break;
+        case 'c':
+            config.concurrency = strtol( optarg, NULL, 10 );
+            break;
+        case 't':
+            threads = strtol( optarg, NULL, 10 );
+            break;
+        case 'n':
+            config.connections = strtoull( optarg, NULL, 10 );
+            break;
+        case 'd':
+            config.duration_ns = (uint64_t)(strtod( optarg, NULL ) * 1e9);
+            break;
+        case 'T':
+            config.timeout_ns = strtoull( optarg, NULL, 10 ) * 1000000ull;
+            break;
+        case 's':
+            segment_path = optarg;
+            break;
+        case 'o':
+            out_path = optarg;
+            break;
+        case '?':
+            return 1;
+        default:
+            abort ();
+        }
+    }
+
+    if ( NULL == addr_str || NULL == port_str ) {
+        fprintf( stderr, "Both the address and port options must be provided\n" );
+        return 1;
+    }
+    if ( threads < 1 || config.concurrency < threads ) {
+        fprintf( stderr, "Need at least one thread and one connection in flight per thread\n" );
+        return 1;
+    }
+
+    inet6_addr *addr = NULL;
+    if ( str_to_inet6( addr_str, &addr ) )
+        return 1;
+
+    config.server.sin6_family = AF_INET6;
+    config.server.sin6_port = htons( strtol( port_str, NULL, 10 ) );
+    config.server.sin6_addr = *((struct in6_addr*)addr);
+    free( addr );
+
+    if ( NULL != segment_path ) {
+        FILE *segment_file = fopen( segment_path, "r" );
+        if ( NULL == segment_file ) {
+            fprintf( stderr, "Error opening segment file `%s`\n", segment_path );
+            return 1;
+        }
+        config.srh = build_srh_from_file( segment_file );
+        fclose( segment_file );
+        if ( NULL == config.srh ) {
+            fprintf( stderr, "Failed to build SRH.\n" );
+            return 1;
+        }
+        config.srh_len = inet6_rth_space_n( IPV6_RTHDR_TYPE_4, inet6_rth_segments_n( config.srh ) );
+    }
+
+    // A duration based run keeps going until time is up
+    if ( config.duration_ns )
+        config.connections = UINT64_MAX;
+
+    struct load_thread *lts = calloc( threads, sizeof *lts );
+    if ( NULL == lts ) {
+        fprintf( stderr, "Out of memory.\n" );
+        return 1;
+    }
+
+    uint64_t start = now_ns();
+    for ( int t = 0; t < threads; t++ ) {
+        lts[t].config = &config;
+        lts[t].rate = config.rate / threads;
+        lts[t].concurrency = config.concurrency / threads + (t < config.concurrency % threads);
+        lts[t].quota = config.duration_ns ? UINT64_MAX
+            : config.connections / threads + ((uint64_t)t < config.connections % threads);
+        if ( pthread_create( &lts[t].thread, NULL, load_thread_run, &lts[t] ) != 0 ) {
+            fprintf( stderr, "Error creating load thread.\n" );
+            return 1;
+        }
+    }
+
+    load_stats total;
+    memset( &total, 0, sizeof total );
+    for ( int t = 0; t < threads; t++ ) {
+        pthread_join( lts[t].thread, NULL );
+        hist_merge( &total.connect, &lts[t].stats.connect );
+        hist_merge( &total.first_byte, &lts[t].stats.first_byte );
+        hist_merge( &total.srh_setup, &lts[t].stats.srh_setup );
+        total.started += lts[t].stats.started;
+        total.completed += lts[t].stats.completed;
+        total.connect_errors += lts[t].stats.connect_errors;
+        total.srh_errors += lts[t].stats.srh_errors;
+        total.recv_errors += lts[t].stats.recv_errors;
+        total.timeouts += lts[t].stats.timeouts;
+    }
+    double elapsed = (now_ns() - start) / 1e9;
+
+    hist_print( "Connect latency", &total.connect );
+    hist_print( "First byte latency", &total.first_byte );
+    if ( NULL != config.srh )
+        hist_print( "Client SRH setsockopt", &total.srh_setup );
+
+    printf( "%llu started, %llu completed in %.3f s (%.1f conn/s), errors: connect %llu, srh %llu, recv %llu, timeout %llu\n",
+            (unsigned long long)total.started, (unsigned long long)total.completed,
+            elapsed, total.completed / elapsed,
+            (unsigned long long)total.connect_errors, (unsigned long long)total.srh_errors,
+            (unsigned long long)total.recv_errors, (unsigned long long)total.timeouts );
+
+    FILE *out = stdout;
+    if ( NULL != out_path && NULL == (out = fopen( out_path, "w" )) ) {
+        fprintf( stderr, "Error opening output file `%s`\n", out_path );
+        return 1;
+    }
+
+    fprintf( out, "{\"threads\":%d,\"concurrency\":%d,\"target_rate\":%.1f,\"client_srh_segments\":%d,"
+            "\"elapsed_s\":%.6f,\"started\":%llu,\"completed\":%llu,\"rate\":%.1f,"
+            "\"errors\":{\"connect\":%llu,\"srh\":%llu,\"recv\":%llu,\"timeout\":%llu},",
+            threads, config.concurrency, config.rate,
+            config.srh ? inet6_rth_segments_n( config.srh ) : 0,
+            elapsed, (unsigned long long)total.started, (unsigned long long)total.completed,
+            total.completed / elapsed,
+            (unsigned long long)total.connect_errors, (unsigned long long)total.srh_errors,
+            (unsigned long long)total.recv_errors, (unsigned long long)total.timeouts );
+    hist_print_json( out, "connect", &total.connect );
+    fprintf( out, "," );
+    hist_print_json( out, "first_byte", &total.first_byte );
+    fprintf( out, "," );
+    hist_print_json( out, "srh_setup", &total.srh_setup );
+    fprintf( out, "}\n" );
+
+    if ( out != stdout )
+        fclose( out );
+
+    free( lts );
+    return 0;
+}
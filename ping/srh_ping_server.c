@@ -1,8 +1,15 @@
 /* Simple server that listens on a segment routing enabled TCP socket using a
- * given IPv6 address and port.
+ * given IPv6 address and port.  By default it accepts one client and pings it
+ * every second.  With -o it instead accepts clients in a loop, giving each
+ * its routing header and a single ping before hanging up, so the server can
+ * be driven by the SRH load generator to benchmark its accept rate.
  *
  * Args: -i : The IPv6 address of the interface to listen on -p : The port to
- * listen on
+ * listen on -o : Send one ping per connection and keep accepting -v : Log
+ * every connection in -o mode, not just the first (logging is slow enough to
+ * skew a benchmark) -u : Compress a routing header that is too big for the
+ * path MTU into uSIDs.  Only use this when every router on the path supports
+ * uSID (NEXT-CSID) processing, otherwise the traffic is dropped.
  *
  * Author: Dave Sizer
  *
@@ -21,9 +28,19 @@
 
 #include "ping_common.h"
 #include "sr_api.h"
+#include "srh_multipath.h"
+#include "srh_plan.h"
 
 
-void start_server(inet6_addr* listen_addr, uint16_t port, void *srh, socklen_t srh_size);
+/* The server's own switches, on top of the common connection options */
+struct server_options {
+    int one_shot;
+    int verbose;
+    int compress;
+};
+
+int take_flag(int *argc, char **argv, const char *flag);
+void start_server(inet6_addr* listen_addr, uint16_t port, void *srh, socklen_t srh_size, const struct server_options *opts, srh_multipath *mp);
 
 
 int main(int argc, char **argv) {
@@ -32,11 +49,23 @@ int main(int argc, char **argv) {
     // address
     const char *SEGMENT_PATH = "segments.txt";
 
+    // Optional file with several weighted segment lists.  When it exists,
+    // connections are spread across those paths instead of the single path in
+    // SEGMENT_PATH
+    const char *MULTIPATH_PATH = "multipath.txt";
+
 
     uint16_t port;
     inet6_addr *addr = NULL;
     void *header_1 = NULL, *header_2 = NULL;
     FILE *segment_file = NULL;
+    srh_multipath *mp = NULL;
+    struct server_options opts;
+
+    // Take out the server's own switches before the common options are parsed
+    opts.one_shot = take_flag( &argc, argv, "-o" );
+    opts.verbose = take_flag( &argc, argv, "-v" );
+    opts.compress = take_flag( &argc, argv, "-u" );
 
     // Parse the bind address and port from the command line
     int parse_res = parse_connection_options(argc, argv, &addr, &port); 
@@ -51,6 +80,25 @@ int main(int argc, char **argv) {
     printf( "Got port %d\n", port );
 
 
+    // Multipath mode, if a path set is present
+    if( (segment_file = fopen( MULTIPATH_PATH, "r" )) != NULL ) {
+        mp = srh_multipath_load( segment_file );
+        fclose( segment_file );
+
+        if ( NULL == mp ) {
+            fprintf( stderr, "Failed to load multipath file `%s`\n", MULTIPATH_PATH );
+            return 1;
+        }
+
+        printf( "Spreading connections across %d paths:\n", mp->path_count );
+        for ( int i = 0; i < mp->path_count; i++ ) {
+            printf( "Path %d, weight %u:\n", i, mp->paths[i].weight );
+            print_segment_addresses( mp->paths[i].srh );
+        }
+        start_server( addr, port, NULL, 0, &opts, mp );
+        return 0;
+    }
+
     // Open the input file
     if( (segment_file = fopen( SEGMENT_PATH, "r" )) == NULL ) {
         fprintf( stderr, "Error opening segment file `%s`\n", SEGMENT_PATH );
@@ -75,13 +123,31 @@ int main(int argc, char **argv) {
 
     printf( "Hex dump of routing header:\n" );
     hex_print( header_2, hdr_len_2 );
-    start_server( addr, port , header_2, hdr_len_2);
+    start_server( addr, port , header_2, hdr_len_2, &opts, NULL);
     
     return 0;
 
 }
 
-void start_server(inet6_addr* listen_addr, uint16_t port, void *srh, socklen_t srh_size) {
+/* Remove every occurrence of flag from the arguments
+ *
+ * Return: Nonzero if the flag was given
+ */
+int take_flag(int *argc, char **argv, const char *flag) {
+    int found = 0;
+    for ( int i = 1; i < *argc; ) {
+        if ( strcmp( argv[i], flag ) == 0 ) {
+            memmove( &argv[i], &argv[i + 1], (*argc - i) * sizeof *argv );
+            (*argc)--;
+            found = 1;
+        } else {
+            i++;
+        }
+    }
+    return found;
+}
+
+void start_server(inet6_addr* listen_addr, uint16_t port, void *srh, socklen_t srh_size, const struct server_options *opts, srh_multipath *mp) {
     int listen_sock = 0, conn_sock = 0;
 
     const char *send_data = "PING.\n";
@@ -126,8 +192,9 @@ void start_server(inet6_addr* listen_addr, uint16_t port, void *srh, socklen_t s
     }
     printf( "Listen socket bound successfully...\n" );
 
-    // Start listening on the socket
-    if (listen( listen_sock, 10) < 0) {
+    // Start listening on the socket, with room for a burst of connections from
+    // the load generator
+    if (listen( listen_sock, SOMAXCONN) < 0) {
         fprintf( stderr, "Error binding listen socket.\n" );
         fprintf( stderr, "%s\n", strerror(errno) );
         exit( EXIT_FAILURE );
@@ -138,42 +205,82 @@ void start_server(inet6_addr* listen_addr, uint16_t port, void *srh, socklen_t s
     // We will store the socket address of the client so we can get some
     // information about it
     struct sockaddr_in6 client_socket;
-    socklen_t client_socket_len = 0;
-
-    // Accept a client connection. Note I am assuming that we are connecting to
-    // another IPv6 socket.  I would need to test what happens if an IPv4
-    // connection is attempted here
-    if ((conn_sock = accept(listen_sock, (struct sockaddr*)&client_socket, &client_socket_len)) < 0) {
-        fprintf( stderr, "Error accepting client connection.\n" );
-        fprintf( stderr, "%s\n", strerror(errno) );
-        exit( EXIT_FAILURE );
-        
+    socklen_t client_socket_len;
+
+    for ( unsigned long conn_count = 0; ; conn_count++ ) {
+        // Accept a client connection. Note I am assuming that we are connecting
+        // to another IPv6 socket.  I would need to test what happens if an
+        // IPv4 connection is attempted here
+        client_socket_len = sizeof client_socket;
+        if ((conn_sock = accept(listen_sock, (struct sockaddr*)&client_socket, &client_socket_len)) < 0) {
+            // The client gave up before we got to it, or a signal came in
+            if ( errno == ECONNABORTED || errno == EINTR )
+                continue;
+            fprintf( stderr, "Error accepting client connection.\n" );
+            fprintf( stderr, "%s\n", strerror(errno) );
+            exit( EXIT_FAILURE );
+        }
+
+        // Keep the accept loop to accept, setsockopt, send and close unless
+        // asked for more, so a benchmark measures the server and not its
+        // logging
+        int log = opts->verbose || 0 == conn_count;
+
+        // Set the routing header on the socket, picking it by flow in
+        // multipath mode
+        if ( NULL != mp ) {
+            int path = srh_multipath_attach( mp, conn_sock );
+            if ( path < 0 ) {
+                fprintf( stderr, "SRH setsockopt failed.  Are you running kernel 4.10 or newer?\n" );
+                fprintf( stderr, "%d: %s\n", errno, strerror(errno) );
+                exit( EXIT_FAILURE );
+            }
+            if ( log )
+                printf( "Using path %d.\n", path );
+        } else {
+            // Size the header against the path MTU, falling back to a
+            // compressed header if allowed and it leaves too little room for
+            // payload.  The kernel takes the header out of the MSS itself.
+            srh_plan plan;
+            void *fitted = srh_plan_fit( conn_sock, srh, 0, opts->compress, &plan );
+
+            if ( setsockopt(conn_sock, IPPROTO_IPV6, IPV6_RTHDR, fitted,
+                        fitted == srh ? srh_size : (socklen_t)plan.srh_len) < 0 ) {
+                fprintf( stderr, "SRH setsockopt failed.  Are you running kernel 4.10 or newer?\n" );
+                fprintf( stderr, "%d: %s\n", errno, strerror(errno) );
+                exit( EXIT_FAILURE );
+            }
+            if ( fitted != srh )
+                free( fitted );
+
+            if ( log ) {
+                srh_plan_warn( &plan );
+                printf( "Path MTU %d, %d byte routing header, %d bytes of payload per segment.\n",
+                        plan.mtu, plan.srh_len, plan.max_payload );
+            }
+        }
+
+        // Print the address of the connected client
+        char client_addr_str[INET6_ADDRSTRLEN];
+        if ( log && inet_ntop(AF_INET6, &client_socket.sin6_addr, client_addr_str, INET6_ADDRSTRLEN) )
+            printf( "%s connected.\n", client_addr_str );
+
+        if ( opts->one_shot ) {
+            // A single ping, then hang up.  A client that already left must
+            // not kill the server with SIGPIPE.
+            send( conn_sock, (void*)send_data, strlen(send_data)+1, MSG_NOSIGNAL );
+            close( conn_sock );
+            continue;
+        }
+
+        // This could be substituted with any TCP application logic that you
+        // want to utilize segment routing with.  For now, we just send the ping
+        // message on a one second delay.
+        while ( 1 ) {
+            printf( "Sending ping...\n" );
+            send( conn_sock, (void*)send_data, strlen(send_data)+1, 0 );
+            sleep( 1 );
+
+        }
     }
-
-    // Set the routing header on the socket
-    if ( setsockopt(conn_sock, IPPROTO_IPV6, IPV6_RTHDR, srh, srh_size) < 0 ) {
-        fprintf( stderr, "SRH setsockopt failed.  Are you running kernel 4.10 or newer?\n" );
-        fprintf( stderr, "%d: %s\n", errno, strerror(errno) );
-        exit( EXIT_FAILURE );
-    }
-
-    // Get and print the address of the connected client
-    char client_addr_str[INET6_ADDRSTRLEN];
-    getpeername( conn_sock, (struct sockaddr*)&client_socket, &client_socket_len );
-    if ( inet_ntop(AF_INET6, &client_socket.sin6_addr, client_addr_str, INET6_ADDRSTRLEN) )
-        printf( "%s connected.\n", client_addr_str );
-
-
-    // This could be substituted with any TCP application logic that you want to
-    // utilize segment routing with.  For now, we just send the ping message on
-    // a one second delay.
-    while ( 1 ) {
-        printf( "Sending ping...\n" );
-        send( conn_sock, (void*)send_data, strlen(send_data)+1, 0 );
-        sleep( 1 );
-
-    }
-
-
-
 }
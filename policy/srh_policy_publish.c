@@ -0,0 +1,154 @@
+/* Publishes segment routing headers into a shared-memory policy table, or
+ * dumps the contents of one.
+ *
+ * Each policy is given as name=file, where file lists segments in the same
+ * format as segments.txt.  All policies are published in a single update.
+ *
+ * Args: -t : Table path (default /dev/shm/srh_policy)
+ *       -c : Table capacity in policies (default 256)
+ *       -m : Maximum segments per header (default 16)
+ *       -d : Dump the table instead of publishing
+ *
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <arpa/inet.h>
+
+#include "ping_common.h"
+#include "sr_api.h"
+#include "srh_policy_table.h"
+
+
+static int dump_table(const char *path);
+static int publish_policies(const char *path, uint32_t capacity, int max_segments, int count, char **specs);
+
+
+int main(int argc, char **argv) {
+    const char *path = SRH_POLICY_DEFAULT_PATH;
+    uint32_t capacity = 256;
+    int max_segments = 16;
+    int dump = 0;
+    int c;
+
+    while ( (c = getopt( argc, argv, "t:c:m:d" )) != -1 ) {
+        switch( c ) {
+        case 't':
+            path = optarg;
+            break;
+        case 'c':
+            capacity = strtoul( optarg, NULL, 10 );
+            break;
+        case 'm':
+            max_segments = strtol( optarg, NULL, 10 );
+            break;
+        case 'd':
+            dump = 1;
+            break;
+        case '?':
+            return 1;
+        default:
+            abort ();
+        }
+    }
+
+    if ( dump )
+        return dump_table( path );
+
+    if ( optind >= argc ) {
+        fprintf( stderr, "Usage: %s [-t table] [-c capacity] [-m max_segments] name=segment_file ...\n", argv[0] );
+        fprintf( stderr, "       %s [-t table] -d\n", argv[0] );
+        return 1;
+    }
+
+    return publish_policies( path, capacity, max_segments, argc - optind, argv + optind );
+}
+
+static int publish_policies(const char *path, uint32_t capacity, int max_segments, int count, char **specs) {
+    srh_policy *policies = calloc( count, sizeof *policies );
+    int res = 1;
+
+    if ( NULL == policies )
+        return 1;
+
+    for ( int i = 0; i < count; i++ ) {
+        char *sep = strchr( specs[i], '=' );
+        if ( NULL == sep ) {
+            fprintf( stderr, "Expected name=segment_file, got `%s`\n", specs[i] );
+            goto done;
+        }
+        *sep = '\0';
+
+        FILE *segment_file = fopen( sep + 1, "r" );
+        if ( NULL == segment_file ) {
+            fprintf( stderr, "Error opening segment file `%s`\n", sep + 1 );
+            goto done;
+        }
+
+        void *srh = build_srh_from_file( segment_file );
+        fclose( segment_file );
+        if ( NULL == srh ) {
+            fprintf( stderr, "Failed to build SRH for `%s`.\n", specs[i] );
+            goto done;
+        }
+
+        policies[i].name = specs[i];
+        policies[i].srh = srh;
+        policies[i].srh_len = inet6_rth_space_n( IPV6_RTHDR_TYPE_4, inet6_rth_segments_n( srh ) );
+
+        // Check everything before the table is touched, so a bad policy
+        // leaves the published set alone
+        if ( inet6_rth_segments_n( srh ) > max_segments ) {
+            fprintf( stderr, "Policy `%s` has %d segments, more than the maximum of %d.\n",
+                    specs[i], inet6_rth_segments_n( srh ), max_segments );
+            goto done;
+        }
+    }
+
+    if ( (uint32_t)count > capacity ) {
+        fprintf( stderr, "%d policies do not fit in a table of %u.\n", count, capacity );
+        goto done;
+    }
+
+    srh_policy_table *table = srh_policy_table_create( path, capacity, max_segments );
+    if ( NULL == table )
+        goto done;
+
+    res = srh_policy_table_publish( table, policies, count );
+    if ( 0 == res )
+        printf( "Published %d policies to `%s`, version %llu\n", count, path,
+                (unsigned long long)srh_policy_table_version( table ) );
+    srh_policy_table_close( table );
+
+done:
+    for ( int i = 0; i < count; i++ )
+        free( (void*)policies[i].srh );
+    free( policies );
+    return res;
+}
+
+static int dump_table(const char *path) {
+    srh_policy_table *table = srh_policy_table_open( path );
+    if ( NULL == table )
+        return 1;
+
+    printf( "Version %llu\n", (unsigned long long)srh_policy_table_version( table ) );
+
+    uint8_t srh[4096];
+    char name[SRH_POLICY_NAME_SIZE];
+    socklen_t srh_len = sizeof srh;
+    uint64_t version;
+
+    for ( uint32_t i = 0;
+            srh_policy_table_get_index( table, i, name, srh, &srh_len, &version ) == 0;
+            i++, srh_len = sizeof srh ) {
+        printf( "%s (%d bytes, version %llu):\n", name, srh_len, (unsigned long long)version );
+        print_segment_addresses( srh );
+    }
+
+    srh_policy_table_close( table );
+    return 0;
+}
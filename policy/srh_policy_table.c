@@ -0,0 +1,553 @@
+/* Shared-memory table of prebuilt segment routing headers
+ *
+ * The mapping starts with a fixed size header followed by capacity equally
+ * sized entries.  The header's sequence counter is the seqlock: the writer
+ * makes it odd before touching any entry and even again once it is done, and
+ * readers retry any copy during which the counter was odd or changed.
+ */
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "srh_policy_table.h"
+#include "sr_api.h"
+
+#define TABLE_MAGIC   0x53524850u  /* "SRHP" */
+#define TABLE_LAYOUT  1
+
+/* Offset of the first entry, which keeps the writer's counter and the
+ * entries on separate cache lines */
+#define TABLE_HEADER_SIZE 64
+
+/* How many times a reader retries a copy before giving up on a writer that
+ * appears stuck mid-update (e.g. it crashed) */
+#define READ_RETRIES 1000000
+
+struct table_header {
+    uint32_t magic;
+    uint32_t layout;
+    uint32_t capacity;
+    uint32_t entry_size;
+    uint32_t max_srh_len;
+    uint32_t count;
+    uint64_t seq;
+    uint64_t size;
+    uint32_t retired;   /* Nonzero once a new table has replaced this one */
+    uint32_t reserved;
+};
+
+struct table_entry {
+    char name[SRH_POLICY_NAME_SIZE];
+    uint32_t srh_len;
+    uint32_t reserved;
+    uint8_t srh[];
+};
+
+struct srh_policy_table {
+    int fd;
+    int writable;
+    size_t size;
+    struct table_header *hdr;
+    uint8_t *entries;
+
+    /* A new table is built under temp_path and only renamed over path once
+     * its first update is complete, so readers never see it half written */
+    char *path;
+    char *temp_path;
+
+    /* The table being replaced, held open and locked until the rename */
+    int old_fd;
+};
+
+
+static struct table_entry *entry_at( const srh_policy_table *table, uint32_t index ) {
+    return (struct table_entry*)(table->entries + (size_t)index * table->hdr->entry_size);
+}
+
+static void write_begin( struct table_header *hdr ) {
+    __atomic_store_n( &hdr->seq, hdr->seq + 1, __ATOMIC_RELAXED );
+    __atomic_thread_fence( __ATOMIC_RELEASE );
+}
+
+static void write_end( struct table_header *hdr ) {
+    __atomic_store_n( &hdr->seq, hdr->seq + 1, __ATOMIC_RELEASE );
+}
+
+static int header_valid( const struct table_header *hdr, size_t size ) {
+    return hdr->magic == TABLE_MAGIC &&
+        hdr->layout == TABLE_LAYOUT &&
+        hdr->size == size &&
+        hdr->entry_size >= sizeof (struct table_entry) + hdr->max_srh_len &&
+        TABLE_HEADER_SIZE + (uint64_t)hdr->capacity * hdr->entry_size <= size;
+}
+
+static srh_policy_table *map_table( int fd, size_t size, int writable ) {
+    srh_policy_table *table = calloc( 1, sizeof *table );
+    if ( NULL == table )
+        return NULL;
+
+    int prot = writable ? PROT_READ | PROT_WRITE : PROT_READ;
+    void *base = mmap( NULL, size, prot, MAP_SHARED, fd, 0 );
+    if ( MAP_FAILED == base ) {
+        fprintf( stderr, "Error mapping policy table.\n" );
+        fprintf( stderr, "%s\n", strerror(errno) );
+        free( table );
+        return NULL;
+    }
+
+    table->fd = fd;
+    table->old_fd = -1;
+    table->writable = writable;
+    table->size = size;
+    table->hdr = base;
+    table->entries = (uint8_t*)base + TABLE_HEADER_SIZE;
+    return table;
+}
+
+
+/* Lay out an empty table in a freshly sized file */
+static void table_init( struct table_header *hdr,
+        uint32_t capacity,
+        uint32_t entry_size,
+        uint32_t max_srh_len,
+        uint64_t seq,
+        size_t size ) {
+    hdr->capacity = capacity;
+    hdr->entry_size = entry_size;
+    hdr->max_srh_len = max_srh_len;
+    hdr->count = 0;
+    hdr->seq = seq;
+    hdr->size = size;
+    hdr->retired = 0;
+    hdr->layout = TABLE_LAYOUT;
+    __atomic_store_n( &hdr->magic, TABLE_MAGIC, __ATOMIC_RELEASE );
+}
+
+/* Open the file at path for writing and take the writer lock on it.  Once
+ * locked it must still be the file at path, since a writer that held the
+ * lock may have renamed a new table over it in the meantime.
+ *
+ * Return: Zero with the locked descriptor in fd (or -1 if there is no file),
+ * nonzero if the file could not be opened or another writer holds it
+ */
+static int open_locked( const char *path, int *fd ) {
+    while ( 1 ) {
+        *fd = open( path, O_RDWR );
+        if ( *fd < 0 ) {
+            if ( ENOENT == errno )
+                return 0;
+            fprintf( stderr, "Error opening policy table `%s`.\n", path );
+            fprintf( stderr, "%s\n", strerror(errno) );
+            return 1;
+        }
+
+        if ( flock( *fd, LOCK_EX | LOCK_NB ) < 0 ) {
+            fprintf( stderr, "Policy table `%s` is locked by another writer.\n", path );
+            fprintf( stderr, "%s\n", strerror(errno) );
+            close( *fd );
+            return 1;
+        }
+
+        struct stat st, path_st;
+        if ( fstat( *fd, &st ) == 0 && stat( path, &path_st ) == 0 &&
+                st.st_dev == path_st.st_dev && st.st_ino == path_st.st_ino )
+            return 0;
+        close( *fd );
+    }
+}
+
+srh_policy_table *srh_policy_table_create( const char *path,
+        uint32_t capacity,
+        int max_segments ) {
+
+    socklen_t max_srh_len = inet6_rth_space_n( IPV6_RTHDR_TYPE_4, max_segments );
+    if ( 0 == capacity || 0 == max_srh_len ) {
+        fprintf( stderr, "Invalid policy table capacity or segment count.\n" );
+        return NULL;
+    }
+
+    // Round entries up to whole cache lines
+    uint32_t entry_size = (sizeof (struct table_entry) + max_srh_len + 63) & ~63u;
+    size_t size = TABLE_HEADER_SIZE + (size_t)capacity * entry_size;
+
+    // Readers may still have an existing table mapped, e.g. across a writer
+    // restart.  If it has the same geometry keep it in place.  Otherwise it
+    // is never resized under them, since their next read would fault; the
+    // replacement is built beside it and renamed into place instead, carrying
+    // the version forward so readers polling it still see it move.
+    uint64_t seq = 0;
+    int old_fd = -1;
+    if ( NULL != path ) {
+        struct stat st;
+        struct table_header existing;
+
+        if ( open_locked( path, &old_fd ) )
+            return NULL;
+
+        if ( old_fd >= 0 && fstat( old_fd, &st ) == 0 &&
+                pread( old_fd, &existing, sizeof existing, 0 ) == sizeof existing &&
+                header_valid( &existing, st.st_size ) ) {
+            seq = (existing.seq + 1) & ~1ull;
+
+            if ( (size_t)st.st_size == size &&
+                    existing.capacity == capacity &&
+                    existing.entry_size == entry_size &&
+                    existing.max_srh_len == max_srh_len ) {
+                srh_policy_table *table = map_table( old_fd, size, 1 );
+                if ( NULL == table ) {
+                    close( old_fd );
+                    return NULL;
+                }
+
+                // A previous writer that died mid-update leaves the counter odd
+                if ( table->hdr->seq & 1 )
+                    write_end( table->hdr );
+                return table;
+            }
+        }
+    }
+
+    char *temp_path = NULL;
+    int fd;
+    if ( NULL == path ) {
+        fd = memfd_create( "srh_policy", 0 );
+    } else if ( asprintf( &temp_path, "%s.XXXXXX", path ) < 0 ) {
+        temp_path = NULL;
+        fd = -1;
+    } else {
+        // Locked before it is renamed into place, so the next writer to
+        // open the path finds it taken
+        fd = mkstemp( temp_path );
+        if ( fd >= 0 && (fchmod( fd, 0644 ) < 0 || flock( fd, LOCK_EX | LOCK_NB ) < 0) ) {
+            unlink( temp_path );
+            close( fd );
+            fd = -1;
+        }
+    }
+
+    if ( fd < 0 ) {
+        fprintf( stderr, "Error creating policy table `%s`.\n", path ? path : "memfd" );
+        fprintf( stderr, "%s\n", strerror(errno) );
+        free( temp_path );
+        if ( old_fd >= 0 )
+            close( old_fd );
+        return NULL;
+    }
+
+    srh_policy_table *table = NULL;
+    if ( ftruncate( fd, size ) < 0 ) {
+        fprintf( stderr, "Error sizing policy table.\n" );
+        fprintf( stderr, "%s\n", strerror(errno) );
+    } else {
+        table = map_table( fd, size, 1 );
+    }
+
+    if ( NULL != table && NULL != path ) {
+        table->path = strdup( path );
+        table->temp_path = temp_path;
+        table->old_fd = old_fd;
+        if ( NULL == table->path ) {
+            munmap( table->hdr, table->size );
+            free( table );
+            table = NULL;
+        }
+    }
+
+    if ( NULL == table ) {
+        if ( NULL != temp_path )
+            unlink( temp_path );
+        free( temp_path );
+        close( fd );
+        if ( old_fd >= 0 )
+            close( old_fd );
+        return NULL;
+    }
+
+    table_init( table->hdr, capacity, entry_size, max_srh_len, seq, size );
+    return table;
+}
+
+srh_policy_table *srh_policy_table_open_fd( int fd ) {
+    struct stat st;
+    if ( fstat( fd, &st ) < 0 || (size_t)st.st_size < TABLE_HEADER_SIZE ) {
+        fprintf( stderr, "Policy table is missing or truncated.\n" );
+        return NULL;
+    }
+
+    srh_policy_table *table = map_table( fd, st.st_size, 0 );
+    if ( NULL == table )
+        return NULL;
+
+    if ( !header_valid( table->hdr, table->size ) ) {
+        fprintf( stderr, "Policy table has an unknown layout.\n" );
+        munmap( table->hdr, table->size );
+        free( table );
+        return NULL;
+    }
+
+    return table;
+}
+
+srh_policy_table *srh_policy_table_open( const char *path ) {
+    int fd = open( path, O_RDONLY );
+    if ( fd < 0 ) {
+        fprintf( stderr, "Error opening policy table `%s`.\n", path );
+        fprintf( stderr, "%s\n", strerror(errno) );
+        return NULL;
+    }
+
+    srh_policy_table *table = srh_policy_table_open_fd( fd );
+    if ( NULL == table )
+        close( fd );
+    return table;
+}
+
+void srh_policy_table_close( srh_policy_table *table ) {
+    if ( NULL == table )
+        return;
+
+    // Never written, so whatever is at the path stays
+    if ( NULL != table->temp_path )
+        unlink( table->temp_path );
+    free( table->temp_path );
+    free( table->path );
+    if ( table->old_fd >= 0 )
+        close( table->old_fd );
+
+    munmap( table->hdr, table->size );
+    close( table->fd );
+    free( table );
+}
+
+int srh_policy_table_fd( const srh_policy_table *table ) {
+    return table->fd;
+}
+
+
+/*
+ * Writer
+ */
+
+/* Mark the table being replaced as retired, as one more update under its
+ * seqlock, so its readers notice on their next read or version poll */
+static void retire_old( srh_policy_table *table ) {
+    if ( table->old_fd < 0 )
+        return;
+
+    struct table_header *hdr = mmap( NULL, TABLE_HEADER_SIZE, PROT_READ | PROT_WRITE,
+            MAP_SHARED, table->old_fd, 0 );
+    if ( MAP_FAILED == hdr )
+        return;
+
+    if ( hdr->magic == TABLE_MAGIC && hdr->layout == TABLE_LAYOUT ) {
+        write_begin( hdr );
+        hdr->retired = 1;
+        write_end( hdr );
+    }
+    munmap( hdr, TABLE_HEADER_SIZE );
+}
+
+/* Move a newly built table into place once it holds its first update */
+static int table_commit( srh_policy_table *table ) {
+    if ( NULL == table->temp_path )
+        return 0;
+
+    retire_old( table );
+
+    if ( rename( table->temp_path, table->path ) < 0 ) {
+        fprintf( stderr, "Error replacing policy table `%s`.\n", table->path );
+        fprintf( stderr, "%s\n", strerror(errno) );
+        return 1;
+    }
+
+    free( table->temp_path );
+    table->temp_path = NULL;
+    if ( table->old_fd >= 0 )
+        close( table->old_fd );
+    table->old_fd = -1;
+    return 0;
+}
+
+static int policy_valid( const srh_policy_table *table, const srh_policy *policy ) {
+    size_t name_len = policy->name ? strlen( policy->name ) : 0;
+    if ( 0 == name_len || name_len >= SRH_POLICY_NAME_SIZE ) {
+        fprintf( stderr, "Policy names must be 1 to %d characters.\n", SRH_POLICY_NAME_SIZE - 1 );
+        return 0;
+    }
+    if ( NULL == policy->srh || policy->srh_len > table->hdr->max_srh_len ) {
+        fprintf( stderr, "Policy `%s` header does not fit in the table.\n", policy->name );
+        return 0;
+    }
+    return 1;
+}
+
+static void entry_store( struct table_entry *entry, const srh_policy *policy ) {
+    memset( entry->name, '\0', SRH_POLICY_NAME_SIZE );
+    strcpy( entry->name, policy->name );
+    entry->srh_len = policy->srh_len;
+    memcpy( entry->srh, policy->srh, policy->srh_len );
+}
+
+int srh_policy_table_publish( srh_policy_table *table,
+        const srh_policy *policies,
+        uint32_t count ) {
+
+    if ( !table->writable || count > table->hdr->capacity ) {
+        fprintf( stderr, "Policy table is read-only or too small.\n" );
+        return 1;
+    }
+
+    for ( uint32_t i = 0; i < count; i++ ) {
+        if ( !policy_valid( table, &policies[i] ) )
+            return 1;
+        for ( uint32_t j = 0; j < i; j++ ) {
+            if ( strcmp( policies[i].name, policies[j].name ) == 0 ) {
+                fprintf( stderr, "Duplicate policy `%s`.\n", policies[i].name );
+                return 1;
+            }
+        }
+    }
+
+    write_begin( table->hdr );
+    for ( uint32_t i = 0; i < count; i++ )
+        entry_store( entry_at( table, i ), &policies[i] );
+    table->hdr->count = count;
+    write_end( table->hdr );
+
+    return table_commit( table );
+}
+
+int srh_policy_table_update( srh_policy_table *table, const srh_policy *policy ) {
+    struct table_header *hdr = table->hdr;
+
+    if ( !table->writable ) {
+        fprintf( stderr, "Policy table is read-only.\n" );
+        return 1;
+    }
+    if ( !policy_valid( table, policy ) )
+        return 1;
+
+    uint32_t index = 0;
+    while ( index < hdr->count && strcmp( entry_at( table, index )->name, policy->name ) != 0 )
+        index++;
+
+    if ( index == hdr->capacity ) {
+        fprintf( stderr, "Policy table is full.\n" );
+        return 1;
+    }
+
+    write_begin( hdr );
+    entry_store( entry_at( table, index ), policy );
+    if ( index == hdr->count )
+        hdr->count++;
+    write_end( hdr );
+
+    return table_commit( table );
+}
+
+
+/*
+ * Readers
+ */
+
+uint64_t srh_policy_table_version( const srh_policy_table *table ) {
+    uint64_t seq = __atomic_load_n( &table->hdr->seq, __ATOMIC_ACQUIRE );
+    if ( __atomic_load_n( &table->hdr->retired, __ATOMIC_RELAXED ) )
+        return SRH_POLICY_VERSION_RETIRED;
+    return seq >> 1;
+}
+
+/* Copy one entry (found by name, or by index when name is NULL) under the
+ * seqlock.  Everything read between the two loads of the counter may be torn,
+ * so it is only bounds checked until the second load proves it consistent.
+ */
+static int read_entry( const srh_policy_table *table,
+        const char *name,
+        uint32_t index,
+        char *name_out,
+        void *srh,
+        socklen_t *srh_len,
+        uint64_t *version ) {
+
+    const struct table_header *hdr = table->hdr;
+
+    for ( int tries = 0; tries < READ_RETRIES; tries++ ) {
+        uint64_t seq = __atomic_load_n( &hdr->seq, __ATOMIC_ACQUIRE );
+        if ( seq & 1 )
+            continue;
+
+        uint32_t retired = hdr->retired;
+        uint32_t count = hdr->count;
+        if ( count > hdr->capacity )
+            count = hdr->capacity;
+
+        const struct table_entry *entry = NULL;
+        if ( NULL != name ) {
+            for ( uint32_t i = 0; i < count; i++ ) {
+                if ( strncmp( entry_at( table, i )->name, name, SRH_POLICY_NAME_SIZE ) == 0 ) {
+                    entry = entry_at( table, i );
+                    break;
+                }
+            }
+        } else if ( index < count ) {
+            entry = entry_at( table, index );
+        }
+
+        uint32_t len = 0;
+        if ( NULL != entry ) {
+            len = entry->srh_len;
+            if ( len > hdr->max_srh_len )
+                len = hdr->max_srh_len;
+            if ( len <= *srh_len )
+                memcpy( srh, entry->srh, len );
+            if ( NULL != name_out )
+                memcpy( name_out, entry->name, SRH_POLICY_NAME_SIZE );
+        }
+
+        __atomic_thread_fence( __ATOMIC_ACQUIRE );
+        if ( __atomic_load_n( &hdr->seq, __ATOMIC_RELAXED ) != seq )
+            continue;
+
+        // The copy is consistent from here on
+        if ( retired )
+            return SRH_POLICY_RETIRED;
+        if ( NULL == entry )
+            return 1;
+        if ( NULL != name_out )
+            name_out[SRH_POLICY_NAME_SIZE - 1] = '\0';
+        if ( NULL != version )
+            *version = seq >> 1;
+
+        int too_small = len > *srh_len;
+        *srh_len = len;
+        return too_small;
+    }
+
+    return 1;
+}
+
+int srh_policy_table_get( const srh_policy_table *table,
+        const char *name,
+        void *srh,
+        socklen_t *srh_len,
+        uint64_t *version ) {
+    return read_entry( table, name, 0, NULL, srh, srh_len, version );
+}
+
+int srh_policy_table_get_index( const srh_policy_table *table,
+        uint32_t index,
+        char *name,
+        void *srh,
+        socklen_t *srh_len,
+        uint64_t *version ) {
+    return read_entry( table, NULL, index, name, srh, srh_len, version );
+}
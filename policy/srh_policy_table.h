@@ -0,0 +1,164 @@
+/* Shared-memory table of prebuilt segment routing headers
+ *
+ * One writer process publishes named routing headers into a shared mapping
+ * (a /dev/shm file, or a memfd handed to child processes), and any number of
+ * reader processes map it read-only.  Updates are guarded by a seqlock, so
+ * readers copy out consistent headers without taking locks or making system
+ * calls, and can poll the table version to notice new policies.
+ *
+ * Only one process may write to a table at a time, which is enforced with an
+ * exclusive flock on the file backing the table.
+ */
+#ifndef __SRH_POLICY_TABLE_H__
+#define __SRH_POLICY_TABLE_H__
+#include <stdint.h>
+#include <sys/socket.h>
+
+/* Longest policy name, including the terminating null */
+#define SRH_POLICY_NAME_SIZE 32
+
+/* Reported once a table has been replaced by a new file at its path, by
+ * srh_policy_table_version and by srh_policy_table_get(_index) respectively.
+ * Readers should then close the table and open the path again. */
+#define SRH_POLICY_VERSION_RETIRED UINT64_MAX
+#define SRH_POLICY_RETIRED 2
+
+/* The default location of the table for publishers and readers */
+#define SRH_POLICY_DEFAULT_PATH "/dev/shm/srh_policy"
+
+/* An open mapping of a policy table, either writable or read-only */
+struct srh_policy_table;
+typedef struct srh_policy_table srh_policy_table;
+
+/* A named routing header, as handed to srh_policy_table_publish */
+struct srh_policy {
+    const char *name;
+    const void *srh;
+    socklen_t srh_len;
+};
+typedef struct srh_policy srh_policy;
+
+/* Create a table, or reopen an existing one with the same geometry, and map
+ * it for writing.  An existing table is never resized in place: a table with
+ * a different capacity or header size is replaced by a new file that is
+ * renamed over it on the first successful publish or update, keeping the
+ * version counting up.  The old file is marked retired just before the
+ * rename, so its readers know to reopen the path.
+ * Args:
+ * path         - File to back the table with, normally under /dev/shm, or
+ *                NULL to create an anonymous memfd (see srh_policy_table_fd)
+ * capacity     - Maximum number of policies the table can hold
+ * max_segments - Maximum number of segments in any one header
+ *
+ * Return: The writable table on success, or NULL on failure, including when
+ * another process holds the table for writing
+ */
+srh_policy_table *srh_policy_table_create( const char *path,
+        uint32_t capacity,
+        int max_segments );
+
+/* Map an existing table read-only
+ * Args:
+ * path - The file backing the table
+ *
+ * Return: The read-only table on success, or NULL on failure
+ */
+srh_policy_table *srh_policy_table_open( const char *path );
+
+/* Map an existing table read-only from an inherited file descriptor, such as
+ * the memfd of a table created with a NULL path before forking
+ * Args:
+ * fd - The file descriptor backing the table.  It is not closed.
+ *
+ * Return: The read-only table on success, or NULL on failure
+ */
+srh_policy_table *srh_policy_table_open_fd( int fd );
+
+/* Unmap a table and close its file descriptor
+ * Args:
+ * table - The table to close, or a null pointer
+ */
+void srh_policy_table_close( srh_policy_table *table );
+
+/* Get the file descriptor backing a table, e.g. to pass a memfd to children
+ * Args:
+ * table - The open table
+ *
+ * Return: The file descriptor
+ */
+int srh_policy_table_fd( const srh_policy_table *table );
+
+/* Replace the whole contents of a writable table in one update, so readers see
+ * either the old policy set or the new one and never a mix
+ * Args:
+ * table    - The writable table
+ * policies - Array of count named headers
+ * count    - The number of policies, at most the table capacity
+ *
+ * Return: Zero on success, nonzero on failure (the table is left unchanged,
+ * unless a new table could not be renamed into place)
+ */
+int srh_policy_table_publish( srh_policy_table *table,
+        const srh_policy *policies,
+        uint32_t count );
+
+/* Add a policy to a writable table, or replace the header of the policy with
+ * the same name
+ * Args:
+ * table   - The writable table
+ * policy  - The named header to store
+ *
+ * Return: Zero on success, nonzero on failure (the table is left unchanged,
+ * unless a new table could not be renamed into place)
+ */
+int srh_policy_table_update( srh_policy_table *table, const srh_policy *policy );
+
+/* Get the table version, which changes every time the writer publishes or
+ * updates.  Cheap enough to poll before every use of a cached header.
+ * Args:
+ * table - The open table
+ *
+ * Return: The current version, or SRH_POLICY_VERSION_RETIRED if the table
+ * has been replaced
+ */
+uint64_t srh_policy_table_version( const srh_policy_table *table );
+
+/* Copy a consistent snapshot of one policy's header out of the table
+ * Args:
+ * table   - The open table
+ * name    - The policy name
+ * srh     - Buffer the header is copied into
+ * srh_len - On input the buffer size, on output the header size
+ * version - If not NULL, set to the table version the header was read at
+ *
+ * Return: Zero on success, SRH_POLICY_RETIRED if the table has been replaced,
+ * or another nonzero value if the policy does not exist, the buffer is too
+ * small, or the writer stayed mid-update for too long
+ */
+int srh_policy_table_get( const srh_policy_table *table,
+        const char *name,
+        void *srh,
+        socklen_t *srh_len,
+        uint64_t *version );
+
+/* Copy a consistent snapshot of the policy at an index, for walking the table
+ * Args:
+ * table   - The open table
+ * index   - Index of the policy, from zero
+ * name    - Buffer of SRH_POLICY_NAME_SIZE bytes the policy name is copied
+ *           into
+ * srh     - Buffer the header is copied into
+ * srh_len - On input the buffer size, on output the header size
+ * version - If not NULL, set to the table version the header was read at
+ *
+ * Return: Zero on success, SRH_POLICY_RETIRED if the table has been replaced,
+ * or another nonzero value if index is past the last policy, the buffer is
+ * too small, or the writer stayed mid-update for too long
+ */
+int srh_policy_table_get_index( const srh_policy_table *table,
+        uint32_t index,
+        char *name,
+        void *srh,
+        socklen_t *srh_len,
+        uint64_t *version );
+#endif
@@ -10,6 +10,10 @@
 #include <netinet/in.h>
 #define IPV6_RTHDR_TYPE_4 4
 
+/* The header length is one octet counting 8 octet units, which leaves room
+ * for at most 127 segments */
+#define IPV6_RTHDR4_MAX_SEGMENTS 127
+
 struct ip6_rthdr4 {
     uint8_t nexthdr;
     uint8_t ip6r4_len;
@@ -0,0 +1,126 @@
+/* Path MTU aware sizing of segment routing headers
+ *
+ * Every segment costs 16 bytes in every packet, so a long segment list eats
+ * into the payload that fits in the path MTU.  The planner works out how much
+ * payload is left per packet once the IPv6 header, the routing header (with
+ * any TLVs) and the transport header are accounted for, and whether the
+ * header is worth warning about or too big to use at all.  Headers that are
+ * too big can be compressed into micro-SID (uSID) containers when their SIDs
+ * allow it, but only on request: every router on the path must then support
+ * uSID (NEXT-CSID) processing, or the traffic is dropped.
+ */
+#ifndef __SRH_PLAN_H__
+#define __SRH_PLAN_H__
+#include <stdint.h>
+#include <sys/socket.h>
+
+/* Fixed header sizes.  TCP options are left out, as the kernel takes them out
+ * of the MSS per segment, as it does the routing header itself. */
+#define SRH_PLAN_IPV6_HEADER 40
+#define SRH_PLAN_TCP_OVERHEAD 20
+#define SRH_PLAN_UDP_OVERHEAD 8
+
+/* The IPv6 minimum MTU, used when the path MTU is unknown */
+#define SRH_PLAN_MIN_MTU 1280
+
+/* Below this much payload per packet a header is considered too big */
+#define SRH_PLAN_MIN_PAYLOAD 512
+
+/* A warning is raised when the header takes more than 1/Nth of the MTU */
+#define SRH_PLAN_WARN_FRACTION 4
+
+/* Limits of one UDP GSO send */
+#define SRH_PLAN_UDP_MAX_SEGMENTS 64
+#define SRH_PLAN_UDP_MAX_BYTES 65000
+
+/* uSID layout used for compression: a 32 bit locator block followed by 16
+ * bit micro-SIDs, six to a container */
+#define SRH_PLAN_USID_BLOCK_BITS 32
+#define SRH_PLAN_USID_BITS 16
+
+/* Plan status codes */
+#define SRH_PLAN_OK      0
+#define SRH_PLAN_WARN    1  /* Usable, but the header is a large part of the MTU */
+#define SRH_PLAN_TOO_BIG 2  /* Less than SRH_PLAN_MIN_PAYLOAD left per packet */
+
+/* The payload budget of a header on a path */
+struct srh_plan {
+    int status;
+    int mtu;                 /* Path MTU the plan is for */
+    int srh_len;             /* Routing header bytes, including TLVs */
+    int overhead;            /* All header bytes per packet */
+    int max_payload;         /* Payload bytes per packet (TCP MSS or UDP datagram size) */
+    int udp_batch_segments;  /* max_payload sized datagrams per UDP GSO send */
+    int compressed;          /* Nonzero if the plan is for a uSID compressed header */
+};
+typedef struct srh_plan srh_plan;
+
+/* Plan the payload budget for a header on a path
+ * Args:
+ * mtu                - The path MTU, or <= 0 to assume SRH_PLAN_MIN_MTU
+ * srh                - The Type-4 routing header, or NULL for none
+ * tlv_len            - Bytes of TLVs that will follow the segment list
+ * transport_overhead - Transport header bytes (e.g. SRH_PLAN_TCP_OVERHEAD)
+ * plan               - Filled in with the result
+ *
+ * Return: The plan status
+ */
+int srh_plan_compute( int mtu,
+        const void *srh,
+        int tlv_len,
+        int transport_overhead,
+        srh_plan *plan );
+
+/* Get the path MTU of a socket, from IPV6_MTU when it is connected and
+ * IPV6_PATHMTU otherwise
+ * Args:
+ * fd - The socket
+ *
+ * Return: The path MTU, or SRH_PLAN_MIN_MTU if it is not known
+ */
+int srh_plan_socket_mtu( int fd );
+
+/* Plan a header for a socket and get the header to use on it.  Only if
+ * compress is set and the header is too big for the socket's path MTU is a
+ * uSID compressed copy tried instead.  Nothing is printed, see srh_plan_warn.
+ * Args:
+ * fd       - A TCP or UDP socket
+ * srh      - The Type-4 routing header
+ * tlv_len  - Bytes of TLVs that will follow the segment list
+ * compress - Nonzero to allow uSID compression, for paths whose routers all
+ *            support it
+ * plan     - Filled in with the plan for the returned header
+ *
+ * Return: srh itself, or a malloc'd compressed header the caller must free
+ */
+void *srh_plan_fit( int fd, void *srh, int tlv_len, int compress, srh_plan *plan );
+
+/* Print a warning to stderr if a plan's header is large or too big for its
+ * path MTU
+ * Args:
+ * plan - The plan to check
+ */
+void srh_plan_warn( const srh_plan *plan );
+
+/* Size a UDP socket's GSO segments to a plan, so every datagram fits the path
+ * MTU.  TCP sockets need nothing: the kernel already takes the routing header
+ * out of the MSS once it is set on the socket.
+ * Args:
+ * fd   - The socket
+ * plan - The plan to apply
+ *
+ * Return: Zero on success or for TCP sockets, nonzero on failure
+ */
+int srh_plan_apply( int fd, const srh_plan *plan );
+
+/* Compress a header into uSID containers.  Every SID must share the same
+ * SRH_PLAN_USID_BLOCK_BITS locator block, and carry a non-zero micro-SID in
+ * the next SRH_PLAN_USID_BITS bits with all remaining bits zero.
+ * Args:
+ * srh - The Type-4 routing header to compress
+ *
+ * Return: A malloc'd compressed header, or NULL if the SIDs are not uSIDs or
+ * compression would not save anything
+ */
+void *srh_compress_usid( const void *srh );
+#endif
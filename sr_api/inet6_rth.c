@@ -39,15 +39,16 @@
 
    This function returns the number of bytes required to hold a
    Routing header of the specified type containing the specified
-   number of segments (addresses).  For an IPv6 Type 0 Routing header,
-   the number of segments must be between 0 and 127, inclusive.  */
+   number of segments (addresses).  For an IPv6 Type 4 Routing header,
+   the number of segments must be between 0 and
+   IPV6_RTHDR4_MAX_SEGMENTS, inclusive.  */
 socklen_t
 inet6_rth_space_n (int type, int segments)
 {
   switch (type)
     {
     case IPV6_RTHDR_TYPE_4:
-      if (segments < 0 || segments > 255 )
+      if (segments < 0 || segments > IPV6_RTHDR4_MAX_SEGMENTS)
           return 0;
 
       return sizeof (struct ip6_rthdr4) + segments * sizeof (struct in6_addr);
@@ -71,7 +72,7 @@ inet6_rth_init_n (void *bp, socklen_t bp_len, int type, int segments)
     {
     case IPV6_RTHDR_TYPE_4:
       /* Make sure the parameters are valid and the buffer is large enough.  */
-      if (segments < 0 || segments > 255)
+      if (segments < 0 || segments > IPV6_RTHDR4_MAX_SEGMENTS)
 	break;
 
       socklen_t len = (sizeof (struct ip6_rthdr4)
@@ -0,0 +1,198 @@
+/* Path MTU aware sizing of segment routing headers
+ *
+ * See srh_plan.h for the public API.
+ */
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <netinet/in.h>
+#include <netinet/ip6.h>
+#include <netinet/udp.h>
+
+#include "sr_api.h"
+#include "srh_plan.h"
+
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+
+#define USID_BLOCK_BYTES (SRH_PLAN_USID_BLOCK_BITS / 8)
+#define USID_BYTES (SRH_PLAN_USID_BITS / 8)
+#define USIDS_PER_CONTAINER ((128 - SRH_PLAN_USID_BLOCK_BITS) / SRH_PLAN_USID_BITS)
+
+
+int srh_plan_compute( int mtu,
+        const void *srh,
+        int tlv_len,
+        int transport_overhead,
+        srh_plan *plan ) {
+
+    const struct ip6_rthdr4 *rthdr = (const struct ip6_rthdr4*)srh;
+
+    memset( plan, 0, sizeof *plan );
+    plan->mtu = mtu > 0 ? mtu : SRH_PLAN_MIN_MTU;
+
+    // Length in units of 8 octets, not counting the first 8
+    if ( NULL != rthdr )
+        plan->srh_len = (rthdr->ip6r4_len + 1) * 8 + tlv_len;
+
+    plan->overhead = SRH_PLAN_IPV6_HEADER + plan->srh_len + transport_overhead;
+    plan->max_payload = plan->mtu - plan->overhead;
+    if ( plan->max_payload < 0 )
+        plan->max_payload = 0;
+
+    if ( plan->max_payload > 0 ) {
+        plan->udp_batch_segments = SRH_PLAN_UDP_MAX_BYTES / plan->max_payload;
+        if ( plan->udp_batch_segments > SRH_PLAN_UDP_MAX_SEGMENTS )
+            plan->udp_batch_segments = SRH_PLAN_UDP_MAX_SEGMENTS;
+    }
+
+    if ( plan->max_payload < SRH_PLAN_MIN_PAYLOAD )
+        plan->status = SRH_PLAN_TOO_BIG;
+    else if ( plan->srh_len * SRH_PLAN_WARN_FRACTION > plan->mtu )
+        plan->status = SRH_PLAN_WARN;
+    else
+        plan->status = SRH_PLAN_OK;
+
+    return plan->status;
+}
+
+int srh_plan_socket_mtu( int fd ) {
+    int mtu = 0;
+    socklen_t mtu_len = sizeof mtu;
+
+    // IPV6_MTU only reports the path MTU once the socket is connected
+    if ( getsockopt( fd, IPPROTO_IPV6, IPV6_MTU, &mtu, &mtu_len ) == 0 && mtu > 0 )
+        return mtu;
+
+    struct ip6_mtuinfo info;
+    socklen_t info_len = sizeof info;
+    if ( getsockopt( fd, IPPROTO_IPV6, IPV6_PATHMTU, &info, &info_len ) == 0 &&
+            info.ip6m_mtu > 0 )
+        return info.ip6m_mtu;
+
+    return SRH_PLAN_MIN_MTU;
+}
+
+static int socket_protocol( int fd ) {
+    int proto = 0;
+    socklen_t proto_len = sizeof proto;
+    if ( getsockopt( fd, SOL_SOCKET, SO_PROTOCOL, &proto, &proto_len ) < 0 )
+        return -1;
+    return proto;
+}
+
+static int transport_overhead( int proto ) {
+    switch ( proto ) {
+    case IPPROTO_TCP:
+        return SRH_PLAN_TCP_OVERHEAD;
+    case IPPROTO_UDP:
+        return SRH_PLAN_UDP_OVERHEAD;
+    }
+    return 0;
+}
+
+void *srh_plan_fit( int fd, void *srh, int tlv_len, int compress, srh_plan *plan ) {
+    int mtu = srh_plan_socket_mtu( fd );
+    int overhead = transport_overhead( socket_protocol( fd ) );
+
+    void *fitted = srh;
+    if ( srh_plan_compute( mtu, srh, tlv_len, overhead, plan ) == SRH_PLAN_TOO_BIG &&
+            compress ) {
+        void *compressed = srh_compress_usid( srh );
+        srh_plan compressed_plan;
+
+        if ( NULL != compressed ) {
+            srh_plan_compute( mtu, compressed, tlv_len, overhead, &compressed_plan );
+            compressed_plan.compressed = 1;
+            *plan = compressed_plan;
+            fitted = compressed;
+        }
+    }
+
+    return fitted;
+}
+
+void srh_plan_warn( const srh_plan *plan ) {
+    if ( plan->status != SRH_PLAN_OK ) {
+        fprintf( stderr, "Warning: %s%d byte routing header leaves %d bytes of payload in a %d byte path MTU%s.\n",
+                plan->compressed ? "compressed " : "",
+                plan->srh_len, plan->max_payload, plan->mtu,
+                plan->status == SRH_PLAN_TOO_BIG ? ", expect fragmentation or drops" : "" );
+    }
+}
+
+int srh_plan_apply( int fd, const srh_plan *plan ) {
+    int size = plan->max_payload;
+    if ( size <= 0 )
+        return 1;
+
+    switch ( socket_protocol( fd ) ) {
+    case IPPROTO_TCP:
+        // The kernel counts the routing header against the MSS itself
+        return 0;
+    case IPPROTO_UDP:
+        return setsockopt( fd, SOL_UDP, UDP_SEGMENT, &size, sizeof size ) < 0;
+    }
+
+    return 1;
+}
+
+void *srh_compress_usid( const void *srh ) {
+    const struct ip6_rthdr4 *rthdr = (const struct ip6_rthdr4*)srh;
+    int segments = inet6_rth_segments_n( srh );
+    static const uint8_t zero[16];
+
+    if ( segments < 2 )
+        return NULL;
+
+    int containers = (segments + USIDS_PER_CONTAINER - 1) / USIDS_PER_CONTAINER;
+    if ( containers >= segments )
+        return NULL;
+
+    // The header stores the last segment first, so the first segment to
+    // visit is at the end
+    struct in6_addr first;
+    memcpy( &first, rthdr->ip6r4_addr[segments - 1].s6_addr, sizeof first );
+    for ( int i = 0; i < segments; i++ ) {
+        const uint8_t *sid = rthdr->ip6r4_addr[i].s6_addr;
+        if ( memcmp( sid, first.s6_addr, USID_BLOCK_BYTES ) != 0 ||
+                memcmp( sid + USID_BLOCK_BYTES, zero, USID_BYTES ) == 0 ||
+                memcmp( sid + USID_BLOCK_BYTES + USID_BYTES, zero,
+                    16 - USID_BLOCK_BYTES - USID_BYTES ) != 0 )
+            return NULL;
+    }
+
+    // Pack the micro-SIDs in the order they are visited, behind a copy of the
+    // shared block.  Unused positions stay zero, which ends the container.
+    struct in6_addr packed[IPV6_RTHDR4_MAX_SEGMENTS];
+    memset( packed, 0, containers * sizeof *packed );
+    for ( int i = 0; i < segments; i++ ) {
+        struct in6_addr *container = &packed[i / USIDS_PER_CONTAINER];
+        const uint8_t *sid = rthdr->ip6r4_addr[segments - 1 - i].s6_addr;
+
+        memcpy( container->s6_addr, sid, USID_BLOCK_BYTES );
+        memcpy( container->s6_addr + USID_BLOCK_BYTES + (i % USIDS_PER_CONTAINER) * USID_BYTES,
+                sid + USID_BLOCK_BYTES, USID_BYTES );
+    }
+
+    socklen_t hdr_size = inet6_rth_space_n( IPV6_RTHDR_TYPE_4, containers );
+    void *hdr = malloc( hdr_size );
+    if ( NULL == hdr )
+        return NULL;
+
+    inet6_rth_init_n( hdr, hdr_size, IPV6_RTHDR_TYPE_4, containers );
+    for ( int i = containers - 1; i >= 0; i-- )
+        inet6_rth_add_n( hdr, &packed[i] );
+
+    struct ip6_rthdr4 *out = (struct ip6_rthdr4*)hdr;
+    out->nexthdr = rthdr->nexthdr;
+    out->ip6r4_segleft = containers - 1;
+    out->ip6r4_lastentry = containers - 1;
+    out->ip6r4_flags = rthdr->ip6r4_flags;
+    out->ip6r4_tag = rthdr->ip6r4_tag;
+
+    return hdr;
+}